@@ -5,19 +5,90 @@
 #include "facedetector.h"
 #include "utils.h"
 
-bool LBFModel::train(const string &settingsfile)
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <omp.h>
+
+namespace {
+  // image and points file of the i-th sample of a data set, counting from 1
+  void sampleFileNames(const map<string, string> &configs, int i, string &imgfile, string &ptsfile) {
+    string idxstr = padWith(toString(i), '0', stoi(configs.at("digits")));
+    imgfile = configs.at("path") + configs.at("prefix") + idxstr + configs.at("imgext");
+    ptsfile = configs.at("path") + configs.at("prefix") + idxstr + configs.at("ptsext");
+  }
+
+  // the first detected box that contains most of the annotated points
+  bool findFaceBox(const vector<FaceDetector::BoundingBox> &boxes, const Eigen::VectorXd &pts,
+                   FaceDetector::BoundingBox &face) {
+    const double CUTOFF = 0.75;
+    for (auto &box : boxes) {
+      int count = 0;
+      for (int pidx = 0; pidx < pts.rows() / 2; ++pidx) {
+        double x = pts(pidx * 2), y = pts(pidx * 2 + 1);
+        if (box.isInside(x, y)) ++count;
+      }
+      double perc = (double)count / (double)(pts.rows() / 2);
+      if (perc > CUTOFF) {
+        face = box;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // faces are cropped to the detected box enlarged by this factor
+  const double cropScale = 2.0;
+
+  // crops the enlarged face box and scales it so that the box is wsize wide,
+  // the parts outside of the image replicate its border. a point p of the image
+  // is at (p - origin) * scale in the returned face image
+  cv::Mat cropFace(const cv::Mat &img, const FaceDetector::BoundingBox &box, int wsize,
+                   Eigen::Vector2d &origin, double &scale) {
+    int side = cvRound(box.size() * cropScale);
+    cv::Rect crop(cvRound((box.ul.x + box.lr.x - side) * 0.5), cvRound((box.ul.y + box.lr.y - side) * 0.5), side, side);
+    cv::Rect inside = crop & cv::Rect(0, 0, img.cols, img.rows);
+
+    cv::Mat face, scaled;
+    copyMakeBorder(img(inside), face, inside.y - crop.y, crop.br().y - inside.br().y,
+                   inside.x - crop.x, crop.br().x - inside.br().x, BORDER_REPLICATE);
+    int wside = cvRound(wsize * cropScale);
+    cv::resize(face, scaled, Size(wside, wside));
+
+    origin = Eigen::Vector2d(crop.x, crop.y);
+    scale = (double)wside / side;
+    return scaled;
+  }
+}
+
+bool LBFModel::train(const string &settingsfile, const string &modelfile, bool resume)
 {
   cout << "training model with setting file " << settingsfile << endl;
   auto trainingSetParams = readSettingFile(settingsfile);
-  vector<ImageData> inputimages = loadInputImages(trainingSetParams);
-  cout << "number of input images = " << inputimages.size() << endl;
 
-  TrainingSample samples = generateTrainingSamples(inputimages);
+  // the faces are read from the dataset cache when it was written with the
+  // same settings, the cache is mapped for the whole training
+  DatasetCache::Reader cache;
+  vector<ImageData> faces = loadTrainingFaces(trainingSetParams, cache);
+  if (faces.empty()) {
+    cerr << "no valid training faces" << endl;
+    return false;
+  }
+  TrainingSample samples = generateTrainingSamples(faces);
+
+  // continue after the stages of the last checkpoint
+  int firstStage = 0;
+  if (resume) {
+    firstStage = loadCheckpoint(modelfile + ".checkpoint", samples);
+    if (firstStage < 0) return false;
+    cout << "resuming training after stage " << firstStage << endl;
+  }
 
-  // train the model with samples and input images
-  trainModel(inputimages, samples);
+  // train the model with samples and input images, the stages are written to
+  // the model file as they are completed
+  if (!trainModel(faces, samples, modelfile, firstStage)) return false;
 
-  return true;
+  // use the trained model from the file
+  return load(modelfile);
 }
 
 map<string, string> LBFModel::readSettingFile(const string &filename)
@@ -37,6 +108,14 @@ map<string, string> LBFModel::readSettingFile(const string &filename)
       params.T = stoi(child->FirstChildElement("T")->GetText());
       params.N = stoi(child->FirstChildElement("N")->GetText());
       params.D = stoi(child->FirstChildElement("D")->GetText());
+      if (child->FirstChildElement("binwidth") != nullptr)
+        params.binWidth = stoi(child->FirstChildElement("binwidth")->GetText());
+      if (child->FirstChildElement("lambda") != nullptr)
+        params.lambda = stod(child->FirstChildElement("lambda")->GetText());
+      if (child->FirstChildElement("seed") != nullptr)
+        params.seed = stoul(child->FirstChildElement("seed")->GetText());
+      if (child->FirstChildElement("referenceweights") != nullptr)
+        params.referenceWeights = stoi(child->FirstChildElement("referenceweights")->GetText()) != 0;
     }
     child = child->NextSibling();
   }
@@ -49,122 +128,158 @@ map<string, string> LBFModel::readSettingFile(const string &filename)
   return trainingSetParams;
 }
 
-vector<ImageData> LBFModel::loadInputImages(const map<string, string> &configs) {
+vector<ImageData> LBFModel::loadFaces(const map<string, string> &configs) {
   cout << "loading input images ..." << endl;
-  string path = configs.at("path");
-  string prefix = configs.at("prefix");
-  string imgext = configs.at("imgext");
-  string ptsext = configs.at("ptsext");
-  int digits = stoi(configs.at("digits"));
-  int npoints = stoi(configs.at("pointcount"));
   int nimgs = stoi(configs.at("imagecount"));
 
-  vector<ImageData> data;
-  data.reserve(nimgs);
-  for (int i = 1; i <= nimgs; ++i) {
-    string imgfile, ptsfile;
-    string idxstr = padWith(toString(i), '0', digits);
-    imgfile = path + prefix + idxstr + imgext;
-    ptsfile = path + prefix + idxstr + ptsext;
+  // the points are taken from the points file of the data set if there is one
+  PointsFile::Reader points;
+  auto pointsfile = configs.find("pointsfile");
+  if (pointsfile != configs.end() && points.open(pointsfile->second)) {
+    if (points.header().nimages != nimgs) {
+      cerr << "points file " << pointsfile->second << " does not match the data set" << endl;
+      points.close();
+    }
+  }
 
-    ImageData d;
-    bool valid = true;
-    valid &= d.loadImage(imgfile);
-    valid &= d.loadPoints(ptsfile);
+  // every image is decoded once, the files are independent and are loaded in
+  // parallel into their slots so the order of the set is kept. the face is
+  // detected and cropped right away, so the full image is dropped before the
+  // next one is loaded and only the cropped faces are ever kept
+  vector<ImageData> faces(nimgs);
+  vector<char> loaded(nimgs), detected(nimgs);
+  #pragma omp parallel for schedule(dynamic)
+  for (int i = 0; i < nimgs; ++i) {
+    ImageData &d = faces[i];
+    string imgfile, ptsfile;
+    sampleFileNames(configs, i + 1, imgfile, ptsfile);
+    if (points.isOpen()) {
+      const double *pts = points.points(i);
+      loaded[i] = pts != nullptr && d.loadImage(imgfile);
+      if (loaded[i]) d.pts = Eigen::Map<const Eigen::VectorXd>(pts, points.header().Lfp);
+    }
+    else {
+      loaded[i] = d.loadImage(imgfile) && d.loadPoints(ptsfile);
+    }
 
-    if (valid) {
-      data.push_back(d);
+    // keep only the face, cropped and scaled to the window size, the shapes
+    // are then aligned with the face boxes
+    detected[i] = loaded[i] && findFaceBox(FaceDetector::detectFace(d.img), d.pts, d.box);
+    if (detected[i]) {
+      Eigen::Vector2d origin;
+      double scale;
+      d.img = cropFace(d.img, d.box, params.window_size, origin, scale);
+      Eigen::Map<Eigen::MatrixXd> pts(d.pts.data(), 2, d.pts.rows() / 2);
+      pts = (pts.colwise() - origin) * scale;
+    }
+    else {
+      d = ImageData();
     }
   }
+
+  vector<ImageData> data;
+  data.reserve(nimgs);
+  int nloaded = 0;
+  for (int i = 0; i < nimgs; ++i) {
+    if (!loaded[i]) cerr << "failed to load sample " << i + 1 << endl;
+    nloaded += loaded[i];
+    if (detected[i]) data.push_back(faces[i]);
+  }
+  cout << "number of input images = " << nloaded << endl;
+  cout << "Total number of valid input images = " << data.size() << endl;
   return data;
 }
 
-TrainingSample LBFModel::generateTrainingSamples(vector<ImageData> &inputimages) {
-  // find out valid input images
-  vector<pair<int, FaceDetector::BoundingBox>> validSamples;
-  validSamples.reserve(inputimages.size());
-
-  // perform face detection to get the bounding boxes
-  const double CUTOFF = 0.75;
-  for (int imgidx = 0; imgidx < inputimages.size();++imgidx) {
-    auto &img = inputimages[imgidx];
-    auto boxes = FaceDetector::detectFace(img.img);
-
-    // test if the box is valid
-    for (auto &box : boxes) {
-      int count = 0;
-      for (int pidx = 0; pidx < img.pts.rows()/2; ++pidx) {
-        double x = img.pts(pidx * 2), y = img.pts(pidx * 2 + 1);
-        if (box.isInside(x, y)) ++count;
-      }
-      double perc = (double)count / (double)(img.pts.rows() / 2);
-      if (perc > CUTOFF) {
-        validSamples.push_back(make_pair(imgidx, box));
-        break;
+vector<ImageData> LBFModel::loadTrainingFaces(const map<string, string> &configs, DatasetCache::Reader &cache)
+{
+  // the cache is only valid for the settings that determine the faces
+  stringstream settings;
+  settings << configs.at("path") << '\n' << configs.at("prefix") << '\n' << configs.at("imgext") << '\n'
+           << configs.at("ptsext") << '\n' << configs.at("digits") << '\n' << configs.at("pointcount") << '\n'
+           << configs.at("imagecount") << '\n' << params.window_size << '\n' << cropScale;
+  uint64_t settingsHash = DatasetCache::hash(settings.str());
+
+  auto cachefile = configs.find("cachefile");
+  if (cachefile != configs.end() && cache.open(cachefile->second)) {
+    if (cache.header().settingsHash == settingsHash) {
+      cout << "using dataset cache " << cachefile->second << endl;
+      const DatasetCache::Header &header = cache.header();
+      vector<ImageData> faces(header.nfaces);
+      for (int i = 0; i < header.nfaces; ++i) {
+        const int32_t *box = cache.box(i);
+        faces[i].box.ul.x = box[0]; faces[i].box.ul.y = box[1];
+        faces[i].box.lr.x = box[2]; faces[i].box.lr.y = box[3];
+        faces[i].pts = Eigen::Map<const Eigen::VectorXd>(cache.points(i), header.Lfp);
+        faces[i].img = cache.face(i);
       }
+      return faces;
     }
+    cout << "dataset cache " << cachefile->second << " is outdated" << endl;
+    cache.close();
   }
 
-  cout << "Total number of valid input images = " << validSamples.size() << endl;
+  vector<ImageData> faces = loadFaces(configs);
 
-  // scale the valid samples properly
-  const int wsize = params.window_size;
-  for (int i = 0; i < validSamples.size(); ++i) {
-    auto sample = validSamples[i];
-    int idx = sample.first;
-    auto box = sample.second;
-    // scale the image
-    double bsize = box.size();
-    double scale = wsize/bsize;
-    cv::Mat regimg;
-    /// resize the cutout image
-    cv::resize(inputimages[idx].img, regimg, Size(0, 0), scale, scale);
-    inputimages[idx].img = regimg;
-    inputimages[idx].pts *= scale;
+  if (cachefile != configs.end() && !faces.empty()) {
+    cout << "writing dataset cache " << cachefile->second << endl;
+    DatasetCache::Writer writer;
+    bool written = writer.open(cachefile->second, settingsHash, faces.front().pts.rows(), faces.front().img.cols);
+    for (auto &face : faces) {
+      const int box[4] = { face.box.ul.x, face.box.ul.y, face.box.lr.x, face.box.lr.y };
+      written = written && writer.append(box, face.pts, face.img);
+    }
+    written = writer.close() && written;
+    if (!written) cerr << "failed to write dataset cache " << cachefile->second << endl;
   }
+  return faces;
+}
 
+TrainingSample LBFModel::generateTrainingSamples(vector<ImageData> &faces) {
   // generate training samples
   const int oversamples = 20;
-  int N = oversamples * validSamples.size();
-  int Lfp = inputimages.front().pts.rows();
+  int N = oversamples * faces.size();
+  int Lfp = faces.front().pts.rows();
 
   TrainingSample samples;
   samples.imgidx.resize(N);
   samples.truth.resize(N, Lfp);
   samples.guess.resize(N, Lfp);
 
-  std::random_device rd;
-  std::default_random_engine e1(rd());
-  std::uniform_int_distribution<int> uniform_dist(0, validSamples.size());
+  std::default_random_engine e1(params.seed);
+  std::uniform_int_distribution<int> uniform_dist(0, faces.size() - 1);
 
-  for (int i = 0, sidx = 0; i < validSamples.size(); ++i) {
-    // create random samples
+  for (int i = 0, sidx = 0; i < faces.size(); ++i) {
+    // create random samples, the initial guesses are the shapes of other faces
     for (int j = 0; j < oversamples; ++j, ++sidx) {
-      auto sample = validSamples[uniform_dist(e1)];
-      int idx = sample.first;
-      auto box = sample.second;
+      int idx = uniform_dist(e1);
 
-      samples.imgidx[sidx] = idx;
-      samples.truth.row(sidx) = inputimages[validSamples[i].first].pts;
-      samples.guess.row(sidx) = inputimages[idx].pts;
+      samples.imgidx[sidx] = i;
+      samples.truth.row(sidx) = faces[i].pts;
+      samples.guess.row(sidx) = faces[idx].pts;
     }
   }
   return samples;
 }
 
-void LBFModel::trainModel(vector<ImageData> &imgdata, TrainingSample &samples)
+bool LBFModel::trainModel(vector<ImageData> &imgdata, TrainingSample &samples, const string &modelfile, int firstStage)
 {
   int Lfp = imgdata.front().pts.rows();
   int Nfp = Lfp / 2;
   int nsamples = samples.guess.rows();
 
   // compute a meanshape as reference shape
-  Eigen::VectorXd meanshape = samples.truth.colwise().mean();
-  Eigen::Vector2d leftPupil = extractPoint(meanshape, 37) + extractPoint(meanshape, 38) + extractPoint(meanshape, 40) + extractPoint(meanshape, 41);
-  Eigen::Vector2d rightPupil = extractPoint(meanshape, 43) + extractPoint(meanshape, 44) + extractPoint(meanshape, 46) + extractPoint(meanshape, 47);
-  double ref_dist = (leftPupil - rightPupil).norm();
+  meanshape = samples.truth.colwise().mean();
+  double ref_dist = interPupilDistance(meanshape);
+
+  ModelFile::Writer writer;
+  bool opened = firstStage > 0 ? writer.resume(modelfile, fileHeader(), meanshape, firstStage)
+                               : writer.open(modelfile, fileHeader(), meanshape);
+  if (!opened) {
+    cerr << "failed to open model file " << modelfile << endl;
+    return false;
+  }
 
-  for (int t = 0; t < params.T; ++t) {
+  for (int t = firstStage; t < params.T; ++t) {
     // compute the transformation from guess shape to the meanshape
     vector<Eigen::Matrix2d> M(nsamples);
     vector<Eigen::Matrix2d> invM(nsamples);
@@ -173,70 +288,489 @@ void LBFModel::trainModel(vector<ImageData> &imgdata, TrainingSample &samples)
       invM[i] = M[i].inverse();
     }
 
-    // compute the deltashape
-    Eigen::MatrixXd deltashape = samples.truth - samples.guess;
+    // compute the deltashape, normalized to the meanshape space
+    Eigen::MatrixXd deltashape(nsamples, Lfp);
+    for (int i = 0; i < nsamples; ++i) {
+      Eigen::VectorXd ds = samples.truth.row(i) - samples.guess.row(i);
+      deltashape.row(i) = Transform::transformShape(ds, M[i]);
+    }
 
-    // find local binary features for each landmark
-    MappingFunction phi;
+    // find local binary features for each landmark, every landmark is a task
+    // and its trees are spawned as nested tasks, see RegressionForest::train
+    MappingFunction phi(Nfp);
+    PixelSampler sampler(Nfp, params.Npixels);
+    BinaryFeatures features(nsamples, Nfp * params.N, 1 << params.D);
+    #pragma omp parallel
+    #pragma omp single
     for (int l = 0; l < Nfp; ++l) {
-      LandmarkMappingFunction lbf;
+      #pragma omp task firstprivate(l) shared(phi, sampler, features, deltashape, invM, imgdata, samples)
+      {
+        LandmarkMappingFunction &lbf = phi[l];
+
+        // random numbers depend only on the stage and the landmark, not on the
+        // order in which the tasks are run
+        std::seed_seq seq{ params.seed, (unsigned int)t, (unsigned int)l };
+        unsigned int seed;
+        seq.generate(&seed, &seed + 1);
+        std::default_random_engine generator(seed);
+
+        // sample 500 locations around each landmark in the meanshape space, the range of sampling is determined by cross-validation
+        // i.e. for 10 discrete radius, the trees are grown and then applied on the validation set.
+        // the radius can be 0.25, 0.225, 0.20, 0.175, 0.15, 0.125, 0.10, 0.075, 0.05, 0.025. (normalized by the distance between pupils)
+
+        double radius[] = { 0.25, 0.225, 0.20, 0.175, 0.15, 0.125, 0.10, 0.075, 0.05, 0.025 };
+
+        const int Nlocations = params.Npixels;
+        double radius_t = radius[t];
+        // sample the locations
+        std::normal_distribution<double> randn(0, 1);
+        lbf.locations.resize(Nlocations, 2);
+        for (int i = 0; i < Nlocations; ++i) {
+          lbf.locations(i, 0) = randn(generator);
+          lbf.locations(i, 1) = randn(generator);
+        }
+        lbf.locations *= (radius_t * ref_dist);
+
+        // get the pixel values by transforming back to the image space, the
+        // intensities are kept as 8-bit values in a column-major matrix
+        sampler.setLocations(l, lbf.locations);
+        PixelMatrix<uint8_t> pixels(nsamples, Nlocations);
+        Eigen::Matrix<uint8_t, 1, Eigen::Dynamic> values(Nlocations);
+        for (int i = 0; i < nsamples; ++i) {
+          sampler.sampleLandmark(imgdata[samples.imgidx[i]].img, samples.guess.row(i), invM[i], l, values.data());
+          pixels.row(i) = values;
+        }
+
+        Eigen::MatrixXd ds = deltashape.block(0, l * 2, deltashape.rows(), 2);
+
+        // grow N trees for this landmark, and compute the the local binary feature
+        lbf.forest.init(params.N, params.D, params.Ndims, 0.05, tree_t::VarianceReduction, params.binWidth);
+        lbf.forest.train(pixels, ds, generator());
+
+        // collect the feature vectors, only the index of the active leaf of each tree
+        for (int k = 0; k < params.N; ++k) {
+          for (int i = 0; i < nsamples; ++i) {
+            features.leaves(i, l * params.N + k) = lbf.forest.trees[k].leafIndex(pixels.row(i));
+          }
+        }
+      }
+    }
 
-      // sample 500 locations around each landmark in the meanshape space, the range of sampling is determined by cross-validation
-      // i.e. for 10 discrete radius, the trees are grown and then applied on the validation set.
-      // the radius can be 0.25, 0.225, 0.20, 0.175, 0.15, 0.125, 0.10, 0.075, 0.05, 0.025. (normalized by the distance between pupils)
+    // global linear regression on the training data using LBFs. the forests
+    // are moved into the stage, a copy would double their memory
+    Stage stage;
+    stage.phi = std::move(phi);
+    // liblinear minimizes |w|^2 / 2 + C * loss, i.e. C = 1 / (2 * lambda)
+    std::seed_seq seq{ params.seed, (unsigned int)t };
+    unsigned int seed;
+    seq.generate(&seed, &seed + 1);
+    RowMatrixXd W;
+    if (!GlobalRegression::trainSVR(features, deltashape, 0.5 / params.lambda, 0.1, seed, W)) return false;
+
+    // the model only keeps W quantized to int16 rows, and optionally the rows
+    // before quantization to measure the error of the quantization
+    stage.W.quantize(W);
+    if (params.referenceWeights) stage.reference = W.cast<float>();
+
+    // update the guess shapes, the increments are in the meanshape space. the
+    // quantized W is used so that training follows what fitting will do
+    Eigen::MatrixXd increments = GlobalRegression::predict(features, W);
+    Eigen::MatrixXd incrementsq = GlobalRegression::predict(features, stage.W);
+    double err = 0, errq = 0;
+    for (int i = 0; i < nsamples; ++i) {
+      Eigen::VectorXd inc = increments.row(i), incq = incrementsq.row(i);
+      Eigen::VectorXd truth = samples.truth.row(i), guess = samples.guess.row(i);
+      double dist = interPupilDistance(truth);
+      err += meanError(guess + Transform::transformShape(inc, invM[i]), truth) / dist;
+      errq += meanError(guess + Transform::transformShape(incq, invM[i]), truth) / dist;
+      samples.guess.row(i) += Transform::transformShape(incq, invM[i]);
+    }
+    cout << "stage " << t << ": training NME = " << err / nsamples
+         << ", with quantized W = " << errq / nsamples << endl;
+
+    // append the stage to the model file and drop it, the file is a usable
+    // model with the stages trained so far
+    if (!writeStage(writer, stage)) {
+      cerr << "failed to write stage " << t << " to model file " << modelfile << endl;
+      writer.close();
+      return false;
+    }
+    if (!saveCheckpoint(modelfile + ".checkpoint", t + 1, samples)) {
+      writer.close();
+      return false;
+    }
+  }
+  writer.close();
 
-      double radius[] = { 0.25, 0.225, 0.20, 0.175, 0.15, 0.125, 0.10, 0.075, 0.05, 0.025 };
+  // the model is complete, there is nothing left to resume
+  boost::system::error_code ec;
+  boost::filesystem::remove(modelfile + ".checkpoint", ec);
+  return true;
+}
 
-      const int Nlocations = params.Npixels;
-      double radius_t = radius[t];
-      // sample the locations
-      // FIXME implement randn
-      //lbf.locations = arma::randn(500, 2);
-      lbf.locations *= (radius_t * ref_dist);
+namespace {
+  const char checkpointMagic[8] = { 'L', 'B', 'F', 'C', 'K', 'P', 'T', '1' };
 
-      // get the pixel values by transforming back to the image space
-      Eigen::MatrixXd pixels(nsamples, Nlocations);
-      // XXX
+  struct CheckpointHeader {
+    char magic[8];
+    int32_t stages;     // number of completed stages
+    uint32_t seed;      // all random numbers of a stage are derived from the seed
+    int32_t nsamples;
+    int32_t Lfp;
+  };
+}
 
-      Eigen::MatrixXd ds = deltashape.block(0, l * 2, deltashape.rows(), 2);
+bool LBFModel::saveCheckpoint(const string &filename, int stages, const TrainingSample &samples)
+{
+  CheckpointHeader header;
+  memcpy(header.magic, checkpointMagic, sizeof(checkpointMagic));
+  header.stages = stages;
+  header.seed = params.seed;
+  header.nsamples = samples.guess.rows();
+  header.Lfp = samples.guess.cols();
+
+  // write to a temporary file first so a crash never leaves a broken checkpoint
+  string tmpfile = filename + ".tmp";
+  ofstream f(tmpfile, ios::binary);
+  f.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  f.write(reinterpret_cast<const char *>(samples.imgidx.data()), samples.imgidx.size() * sizeof(int));
+  f.write(reinterpret_cast<const char *>(samples.guess.data()), samples.guess.size() * sizeof(double));
+  f.close();
+  if (!f.good()) {
+    cerr << "failed to write checkpoint " << filename << endl;
+    return false;
+  }
+  boost::system::error_code ec;
+  boost::filesystem::rename(tmpfile, filename, ec);
+  if (ec) {
+    cerr << "failed to write checkpoint " << filename << ": " << ec.message() << endl;
+    return false;
+  }
+  return true;
+}
 
-      // grow N trees for this landmark, and compute the the local binary feature
-      lbf.forest.init(params.N, params.D, params.Ndims, 0.05);
-      lbf.forest.train(pixels, ds);
+int LBFModel::loadCheckpoint(const string &filename, TrainingSample &samples)
+{
+  ifstream f(filename, ios::binary);
+  CheckpointHeader header;
+  f.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if (!f.good() || memcmp(header.magic, checkpointMagic, sizeof(checkpointMagic)) != 0) {
+    cerr << "failed to read checkpoint " << filename << endl;
+    return -1;
+  }
 
-      phi.push_back(lbf);
-    }
+  // the training samples are regenerated from the same seed, they must match
+  // the ones the checkpoint was written for
+  vector<int> imgidx(header.nsamples);
+  f.read(reinterpret_cast<char *>(imgidx.data()), imgidx.size() * sizeof(int));
+  if (header.seed != params.seed || header.nsamples != samples.guess.rows() || header.Lfp != samples.guess.cols()
+      || imgidx != samples.imgidx || header.stages > params.T) {
+    cerr << "checkpoint " << filename << " does not match the training set" << endl;
+    return -1;
+  }
 
-    // global linear regression on the training data using LBFs
+  f.read(reinterpret_cast<char *>(samples.guess.data()), samples.guess.size() * sizeof(double));
+  if (!f.good()) {
+    cerr << "truncated checkpoint " << filename << endl;
+    return -1;
+  }
+  return header.stages;
+}
 
-    // collect the feature vectors
+bool LBFModel::convertPoints(const string &settingsfile, const string &pointsfile)
+{
+  cout << "converting the points of setting file " << settingsfile << endl;
 
-    // deltaS matrix
+  // the parameters of the model are kept
+  ModelParameters modelParams = params;
+  auto configs = readSettingFile(settingsfile);
+  params = modelParams;
+  const int nimgs = stoi(configs.at("imagecount"));
 
-    // linear regression with regularization
+  vector<Eigen::VectorXd> points(nimgs);
+  #pragma omp parallel for schedule(dynamic)
+  for (int i = 0; i < nimgs; ++i) {
+    string imgfile, ptsfile;
+    sampleFileNames(configs, i + 1, imgfile, ptsfile);
+    if (!PointsFile::readPts(ptsfile, points[i])) points[i].resize(0);
+  }
 
-    // update the guess shapes
+  int missing = count_if(points.begin(), points.end(), [](const Eigen::VectorXd &pts) { return pts.rows() == 0; });
+  cout << "images without points = " << missing << endl;
+  if (!PointsFile::write(pointsfile, points)) {
+    cerr << "failed to write points file " << pointsfile << endl;
+    return false;
   }
+  return true;
 }
 
 bool LBFModel::batch_test(const string &settingsfile)
 {
   cout << "batch test with setting file " << settingsfile << endl;
 
+  // the parameters of the loaded model are kept
+  ModelParameters modelParams = params;
+  auto testSetParams = readSettingFile(settingsfile);
+  params = modelParams;
+  const int nimgs = stoi(testSetParams.at("imagecount"));
+
+  // errors normalized by the inter-pupil and the inter-ocular distance, -1 for
+  // images without a detected face or without annotations
+  vector<double> pupilErrors(nimgs, -1), ocularErrors(nimgs, -1);
+  double fittingTime = 0;
+
+  // the same faces are also fitted with W before quantization when the model
+  // stores it, to report the error the quantization adds
+  const bool compareReference = hasReferenceWeights();
+  vector<double> referencePupilErrors(nimgs, -1), referenceOcularErrors(nimgs, -1);
+
+  // the images are loaded one chunk ahead of the chunk being fitted, so at most
+  // two chunks are in memory and decoding overlaps with fitting
+  const int chunksize = 4 * omp_get_max_threads();
+  vector<ImageData> current(chunksize), next(chunksize);
+  vector<char> currentValid(chunksize), nextValid(chunksize);
+
+  // spawns one loading task per image, the tasks are waited for by the caller
+  auto loadChunk = [&](int first, ImageData *images, char *valid) {
+    for (int i = 0; i < chunksize && first + i < nimgs; ++i) {
+      #pragma omp task firstprivate(i, first, images, valid) shared(testSetParams)
+      {
+        string imgfile, ptsfile;
+        sampleFileNames(testSetParams, first + i + 1, imgfile, ptsfile);
+        images[i] = ImageData();
+        valid[i] = images[i].loadImage(imgfile) && images[i].loadPoints(ptsfile);
+      }
+    }
+  };
+
+  // images that were loaded, and went through detection and fitting
+  int nloaded = 0;
+
+  auto start = std::chrono::high_resolution_clock::now();
+  #pragma omp parallel
+  #pragma omp single
+  {
+    loadChunk(0, current.data(), currentValid.data());
+    #pragma omp taskwait
+    for (int first = 0; first < nimgs; first += chunksize) {
+      if (first + chunksize < nimgs) loadChunk(first + chunksize, next.data(), nextValid.data());
+
+      for (int i = 0; i < chunksize && first + i < nimgs; ++i) {
+        if (!currentValid[i]) continue;
+        ++nloaded;
+        #pragma omp task firstprivate(i, first) \
+          shared(current, pupilErrors, ocularErrors, referencePupilErrors, referenceOcularErrors, fittingTime)
+        {
+          const ImageData &d = current[i];
+          FaceDetector::BoundingBox box;
+          if (findFaceBox(FaceDetector::detectFace(d.img), d.pts, box)) {
+            FittingResult result = fit(d.img, box);
+            double err = meanError(result.shape, d.pts);
+            pupilErrors[first + i] = err / interPupilDistance(d.pts);
+            ocularErrors[first + i] = err / interOcularDistance(d.pts);
+
+            double t = 0;
+            for (auto &timing : result.timing) {
+              t += timing.similarity + timing.sampling + timing.traversal + timing.regression;
+            }
+            #pragma omp atomic
+            fittingTime += t;
+
+            if (compareReference) {
+              double referenceErr = meanError(fit(d.img, box, true).shape, d.pts);
+              referencePupilErrors[first + i] = referenceErr / interPupilDistance(d.pts);
+              referenceOcularErrors[first + i] = referenceErr / interOcularDistance(d.pts);
+            }
+          }
+        }
+      }
+      #pragma omp taskwait
+      swap(current, next);
+      swap(currentValid, nextValid);
+    }
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+  // statistics of the fitted images
+  vector<double> errors;
+  double pupilNME = 0, ocularNME = 0, referencePupilNME = 0, referenceOcularNME = 0;
+  for (int i = 0; i < nimgs; ++i) {
+    if (ocularErrors[i] < 0) continue;
+    errors.push_back(ocularErrors[i]);
+    pupilNME += pupilErrors[i];
+    ocularNME += ocularErrors[i];
+    referencePupilNME += referencePupilErrors[i];
+    referenceOcularNME += referenceOcularErrors[i];
+  }
+  const int nfitted = errors.size();
+  if (nfitted == 0) {
+    cerr << "no face fitted in the test set" << endl;
+    return false;
+  }
+  sort(errors.begin(), errors.end());
+
+  // a fitting with an inter-ocular normalized error above the threshold fails
+  const double failureThreshold = 0.1;
+  int nfailed = errors.end() - upper_bound(errors.begin(), errors.end(), failureThreshold);
+
+  cout << "loaded images = " << nloaded << " of " << nimgs << endl;
+  cout << "fitted images = " << nfitted << " of " << nloaded << endl;
+  cout << "NME (inter-pupil) = " << pupilNME / nfitted << endl;
+  cout << "NME (inter-ocular) = " << ocularNME / nfitted << endl;
+  if (compareReference) {
+    cout << "NME before quantization (inter-pupil) = " << referencePupilNME / nfitted << endl;
+    cout << "NME before quantization (inter-ocular) = " << referenceOcularNME / nfitted << endl;
+  }
+  else {
+    cout << "the model has no weights before quantization, train with referenceweights to compare" << endl;
+  }
+  cout << "failure rate = " << (double)nfailed / nfitted << " (NME > " << failureThreshold << ")" << endl;
+  cout << "throughput = " << nloaded / seconds << " loaded images/s, " << nfitted / seconds << " fitted images/s, "
+       << fittingTime / nfitted << " us per fitting" << endl;
+
+  // cumulative error distribution of the inter-ocular normalized errors
+  cout << "CED (inter-ocular):" << endl;
+  for (int i = 0; i <= 15; ++i) {
+    double threshold = i * 0.01;
+    int count = upper_bound(errors.begin(), errors.end(), threshold) - errors.begin();
+    cout << threshold << "\t" << (double)count / nfitted << endl;
+  }
   return true;
 }
 
-bool LBFModel::test(const string &imgfile)
+vector<FittingResult> LBFModel::test(const string &imgfile)
 {
   cout << "test with image file " << imgfile << endl;
 
-  return true;
+  vector<FittingResult> results;
+  ImageData d;
+  if (!d.loadImage(imgfile)) {
+    cerr << "failed to load image " << imgfile << endl;
+    return results;
+  }
+
+  for (auto &box : FaceDetector::detectFace(d.img)) {
+    FittingResult result = fit(d.img, box);
+
+    // latency breakdown of the stages
+    StageTiming total = { 0, 0, 0, 0 };
+    for (int t = 0; t < result.timing.size(); ++t) {
+      const StageTiming &timing = result.timing[t];
+      cout << "stage " << t << ": similarity " << timing.similarity << " us, sampling " << timing.sampling
+           << " us, traversal " << timing.traversal << " us, regression " << timing.regression << " us" << endl;
+      total.similarity += timing.similarity;
+      total.sampling += timing.sampling;
+      total.traversal += timing.traversal;
+      total.regression += timing.regression;
+    }
+    cout << "total: similarity " << total.similarity << " us, sampling " << total.sampling
+         << " us, traversal " << total.traversal << " us, regression " << total.regression << " us, "
+         << total.similarity + total.sampling + total.traversal + total.regression << " us" << endl;
+
+    results.push_back(result);
+  }
+  return results;
+}
+
+bool LBFModel::hasReferenceWeights() const
+{
+  for (auto &stage : modelfile.stages()) {
+    if (stage.reference == nullptr) return false;
+  }
+  return !modelfile.stages().empty();
+}
+
+FittingResult LBFModel::fit(const cv::Mat &img, const FaceDetector::BoundingBox &box, bool reference) const
+{
+  typedef std::chrono::high_resolution_clock clock;
+  auto elapsed = [](clock::time_point from, clock::time_point to) {
+    return std::chrono::duration<double, std::micro>(to - from).count();
+  };
+
+  FittingResult result;
+  result.box = box;
+
+  // the face is cropped and scaled as in training, where the shapes are aligned
+  // with the face boxes, so fitting starts from the meanshape
+  Eigen::Vector2d origin;
+  double scale;
+  cv::Mat scaled = cropFace(img, box, params.window_size, origin, scale);
+  const int Nfp = meanshape.rows() / 2;
+  Eigen::VectorXd shape = meanshape;
+
+  const int N = params.N, D = params.D, Npixels = params.Npixels;
+  const int nnodes = (1 << D) - 1, nleaves = 1 << D;
+  vector<uint8_t> pixels(Nfp * Npixels);
+  vector<uint16_t> leaves(Nfp * N);
+  Eigen::VectorXd increment(meanshape.rows());
+
+  for (auto &stage : modelfile.stages()) {
+    StageTiming timing;
+    auto t0 = clock::now();
+    Eigen::Matrix2d M = Transform::estimateSimilarityTransform(shape, meanshape);
+    Eigen::Matrix2d invM = M.inverse();
+    auto t1 = clock::now();
+
+    // the offsets are in the meanshape space and mapped into the image with invM
+    const float m[4] = { (float)invM(0, 0), (float)invM(0, 1), (float)invM(1, 0), (float)invM(1, 1) };
+    for (int l = 0; l < Nfp; ++l) {
+      PixelSampler::sample(scaled, stage.ox + l * Npixels, stage.oy + l * Npixels, Npixels,
+                           shape[l * 2], shape[l * 2 + 1], m, &pixels[l * Npixels]);
+    }
+    auto t2 = clock::now();
+
+    for (int l = 0; l < Nfp; ++l) {
+      for (int k = 0; k < N; ++k) {
+        const RegressionTreeFlatNode *nodes = stage.nodes + (size_t)(l * N + k) * nnodes;
+        leaves[l * N + k] = flatTreeLeafIndex(nodes, D, &pixels[l * Npixels]);
+      }
+    }
+    auto t3 = clock::now();
+
+    increment.setZero();
+    if (reference) {
+      GlobalRegression::accumulate(stage.reference, meanshape.rows(), leaves.data(), Nfp * N, nleaves, increment.data());
+    }
+    else {
+      GlobalRegression::accumulate(stage.weights, stage.scales, meanshape.rows(),
+                                   leaves.data(), Nfp * N, nleaves, increment.data());
+    }
+    shape += Transform::transformShape(increment, invM);
+    auto t4 = clock::now();
+
+    timing.similarity = elapsed(t0, t1);
+    timing.sampling = elapsed(t1, t2);
+    timing.traversal = elapsed(t2, t3);
+    timing.regression = elapsed(t3, t4);
+    result.timing.push_back(timing);
+  }
+
+  // back to the input image
+  result.shape = shape / scale;
+  Eigen::Map<Eigen::MatrixXd>(result.shape.data(), 2, Nfp).colwise() += origin;
+  return result;
 }
 
 bool LBFModel::load(const string &modelfile)
 {
   cout << "loading model file " << modelfile << endl;
+  if (!this->modelfile.open(modelfile)) {
+    cerr << "failed to load model file " << modelfile << endl;
+    return false;
+  }
 
+  const ModelFile::Header &header = this->modelfile.header();
+  params.window_size = header.windowSize;
+  params.T = header.nstages;
+  params.N = header.N;
+  params.D = header.D;
+  params.Npixels = header.Npixels;
+  meanshape = Eigen::Map<const Eigen::VectorXd>(this->modelfile.meanshape(), header.Nfp * 2);
+
+  if (header.nstages < header.T) {
+    cout << "partial model with " << header.nstages << " of " << header.T << " stages" << endl;
+  }
+  params.print();
   return true;
 }
 
@@ -244,17 +778,68 @@ bool LBFModel::save(const string &modelfile)
 {
   cout << "saving model to file " << modelfile << endl;
 
+  ModelFile::Writer writer;
+  if (!writer.open(modelfile, fileHeader(), meanshape)) {
+    cerr << "failed to open model file " << modelfile << endl;
+    return false;
+  }
+  for (auto &stage : this->modelfile.stages()) {
+    if (!writer.appendStage(stage.ox, stage.oy, stage.nodes, stage.scales, stage.weights, stage.reference)) {
+      cerr << "failed to write model file " << modelfile << endl;
+      writer.close();
+      return false;
+    }
+  }
+  writer.close();
   return true;
 }
 
+ModelFile::Header LBFModel::fileHeader() const
+{
+  ModelFile::Header header;
+  memset(&header, 0, sizeof(header));
+  header.windowSize = params.window_size;
+  header.T = params.T;
+  header.N = params.N;
+  header.D = params.D;
+  header.Npixels = params.Npixels;
+  header.Nfp = meanshape.rows() / 2;
+  return header;
+}
+
+bool LBFModel::writeStage(ModelFile::Writer &writer, const Stage &stage) const
+{
+  // flatten the sampling offsets and the split nodes of all landmarks
+  const int Nfp = stage.phi.size(), Nnodes = (1 << params.D) - 1;
+  vector<float> ox(Nfp * params.Npixels), oy(Nfp * params.Npixels);
+  vector<RegressionTreeFlatNode> nodes((size_t)Nfp * params.N * Nnodes);
+  for (int l = 0; l < Nfp; ++l) {
+    const LandmarkMappingFunction &lbf = stage.phi[l];
+    for (int j = 0; j < params.Npixels; ++j) {
+      ox[l * params.Npixels + j] = lbf.locations(j, 0);
+      oy[l * params.Npixels + j] = lbf.locations(j, 1);
+    }
+    for (int k = 0; k < params.N; ++k) {
+      const RegressionTreeFlatNode *tree = lbf.forest.trees[k].flatNodes();
+      std::copy(tree, tree + Nnodes, &nodes[((size_t)l * params.N + k) * Nnodes]);
+    }
+  }
+  return writer.appendStage(ox.data(), oy.data(), nodes.data(), stage.W.scales.data(), stage.W.values.data(),
+                            stage.reference.size() > 0 ? stage.reference.data() : nullptr);
+}
+
 bool ImageData::loadImage(const string &filename)
 {
   try {
-    cout << "loading image " << filename << endl;
-    original = imread(filename.c_str(), CV_LOAD_IMAGE_UNCHANGED);
-    img = imread(filename.c_str(), CV_LOAD_IMAGE_GRAYSCALE);
-    cout << "image size = " << img.cols << "x" << img.rows << endl;
-    return img.cols > 0 && img.rows > 0;
+    // decode once and derive the grayscale image from the decoded pixels. unlike
+    // CV_LOAD_IMAGE_UNCHANGED these flags keep the EXIF orientation applied, as
+    // with the grayscale mode used before, and 16-bit images are scaled to 8 bits
+    cv::Mat decoded = imread(filename.c_str(), CV_LOAD_IMAGE_ANYDEPTH | CV_LOAD_IMAGE_ANYCOLOR);
+    if (decoded.depth() == CV_16U) decoded.convertTo(decoded, CV_8U, 1.0 / 256);
+    if (decoded.channels() == 3) cvtColor(decoded, img, CV_BGR2GRAY);
+    else if (decoded.channels() == 4) cvtColor(decoded, img, CV_BGRA2GRAY);
+    else img = decoded;
+    return img.cols > 0 && img.rows > 0 && img.depth() == CV_8U;
   }
   catch (exception e) {
     return false;
@@ -263,30 +848,5 @@ bool ImageData::loadImage(const string &filename)
 
 bool ImageData::loadPoints(const string &ptsfile)
 {
-  cout << "loading points " << ptsfile << endl;
-  try {
-    ifstream f(ptsfile);
-    if (!f.good()) return false;
-    string version_tag;
-    f >> version_tag;
-    std::getline(f, version_tag);
-    string pointcount_tag;
-    int npoints;
-    f >> pointcount_tag >> npoints;
-    cout << pointcount_tag << npoints << endl;
-    f.ignore();
-    string dummy;
-    std::getline(f, dummy);
-
-    pts = Eigen::VectorXd(npoints * 2);
-
-    for (int i = 0; i < npoints; ++i) {
-      f >> pts[i * 2] >> pts[i * 2 + 1];
-    }
-    f.close();
-  }
-  catch (exception e) {
-    return false;
-  }
-  return true;
+  return PointsFile::readPts(ptsfile, pts);
 }
@@ -7,6 +7,12 @@
 #include "regressionforest.hpp"
 #include "utils.h"
 #include "transformations.h"
+#include "pixelsampler.h"
+#include "globalregression.h"
+#include "modelfile.h"
+#include "facedetector.h"
+#include "datasetcache.h"
+#include "pointsfile.h"
 
 #include "opencv2/highgui/highgui.hpp"
 using namespace cv;
@@ -14,9 +20,24 @@ using namespace cv;
 struct ImageData {
   bool loadImage(const string &filename);
   bool loadPoints(const string &filename);
-  cv::Mat img;  // resized grayscale image for training
-  cv::Mat original;
-  Eigen::VectorXd pts;  // rescaled points, x1 y1 x2 y2 ... xn yn
+  cv::Mat img;  // grayscale image, cropped to the face and rescaled for training
+  Eigen::VectorXd pts;  // points in img, x1 y1 x2 y2 ... xn yn
+  FaceDetector::BoundingBox box;  // detected face box in the source image
+};
+
+// time spent in the steps of one stage of fitting, in microseconds
+struct StageTiming {
+  double similarity;  // similarity transform from the shape to the meanshape
+  double sampling;    // shape-indexed pixel sampling
+  double traversal;   // finding the active leaves of all trees
+  double regression;  // accumulating the rows of W and updating the shape
+};
+
+// landmarks fitted to one detected face
+struct FittingResult {
+  FaceDetector::BoundingBox box;
+  Eigen::VectorXd shape;        // x1 y1 x2 y2 ... xn yn in the input image
+  vector<StageTiming> timing;   // one entry per stage
 };
 
 struct TrainingSample {
@@ -32,22 +53,44 @@ public:
   LBFModel(const string &modelfile) { load(modelfile); }
   ~LBFModel(){}
 
-  bool train(const string &settingsfile);
-  bool test(const string &imagefile);
+  // trains a model and writes it to modelfile stage by stage, a checkpoint is
+  // written next to it after every stage and removed when all stages are
+  // written. with resume, training continues after the stages of the
+  // checkpoint. training stops if a stage or a checkpoint cannot be written
+  bool train(const string &settingsfile, const string &modelfile, bool resume = false);
+  // fits the landmarks of every face detected in the image
+  vector<FittingResult> test(const string &imagefile);
+  // runs the cascade on a grayscale image starting from the meanshape in the box.
+  // with reference set the weights before quantization are used, which only
+  // models trained with referenceweights store, see hasReferenceWeights
+  FittingResult fit(const cv::Mat &img, const FaceDetector::BoundingBox &box, bool reference = false) const;
+  bool hasReferenceWeights() const;
   bool batch_test(const string &settingsfile);
+  // converts the .pts files of a data set into one points file, used instead
+  // of the .pts files when the settings name it as pointsfile
+  bool convertPoints(const string &settingsfile, const string &pointsfile);
 
   bool load(const string &modelfile);
   bool save(const string &modelfile);
 
 private:
   map<string, string> readSettingFile(const string &filename);
-  vector<ImageData> loadInputImages(const map<string, string> &configs);
-  TrainingSample generateTrainingSamples(vector<ImageData> &inputimages);
-  void trainModel(vector<ImageData> &imgdata, TrainingSample &samples);
+  // the faces of the data set, every image is cropped to its detected face
+  // box right after it is loaded
+  vector<ImageData> loadFaces(const map<string, string> &configs);
+  // cropped training faces from the dataset cache, or from the input images
+  // with the cache written afterwards when the settings name a cachefile
+  vector<ImageData> loadTrainingFaces(const map<string, string> &configs, DatasetCache::Reader &cache);
+  TrainingSample generateTrainingSamples(vector<ImageData> &faces);
+  bool trainModel(vector<ImageData> &imgdata, TrainingSample &samples, const string &modelfile, int firstStage);
+  bool saveCheckpoint(const string &filename, int stages, const TrainingSample &samples);
+  int loadCheckpoint(const string &filename, TrainingSample &samples);
+
+  ModelFile::Header fileHeader() const;
 
 private:
   struct ModelParameters {
-    ModelParameters() :Ndims(500), Npixels(400){}
+    ModelParameters() :Ndims(500), Npixels(400), binWidth(1), lambda(1.0), seed(0), referenceWeights(false){}
 
     int window_size;
     int T;  // number of stages
@@ -55,12 +98,20 @@ private:
     int D;  // depth of decision trees
     int Ndims;
     int Npixels;
+    int binWidth;       // bin width of the split histograms, 0 for exact split search
+    double lambda;      // regularization of the global linear regression
+    unsigned int seed;  // base seed of all random sampling during training
+    bool referenceWeights;  // also store W before quantization, for batch_test
 
     void print() {
       cout << "window size = " << window_size << endl;
       cout << "T = " << T << endl;
       cout << "N = " << N << endl;
       cout << "D = " << D << endl;
+      cout << "bin width = " << binWidth << endl;
+      cout << "lambda = " << lambda << endl;
+      cout << "seed = " << seed << endl;
+      cout << "reference weights = " << referenceWeights << endl;
     }
   } params;
 
@@ -79,7 +130,14 @@ private:
   typedef vector<LandmarkMappingFunction> MappingFunction;
   struct Stage {
     MappingFunction phi;  // feature mapping function
-    Eigen::MatrixXd W;          // weighting matrix
+    QuantizedRowMatrix W; // weighting matrix, one row per leaf of all trees
+    Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> reference;  // W before quantization, if kept
   };
-  vector<MappingFunction> stages;
+  Eigen::VectorXd meanshape;
+
+  // the stages are used in place from the mapped model file, during training
+  // only the stage being trained is kept in memory
+  ModelFile::Reader modelfile;
+
+  bool writeStage(ModelFile::Writer &writer, const Stage &stage) const;
 };
@@ -13,6 +13,11 @@
 #include <string>
 #include <random>
 #include <memory>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+#include <cmath>
+#include <cstring>
 #include <assert.h>
 
 
@@ -0,0 +1,100 @@
+#include "datasetcache.h"
+
+#include <cstring>
+
+namespace {
+  const char magic[8] = { 'L', 'B', 'F', 'F', 'A', 'C', 'E', 'S' };
+  const uint32_t byteOrderMark = 0x01020304;
+
+  size_t recordBytes(int Lfp, int side) {
+    size_t bytes = 16 + Lfp * sizeof(double) + (size_t)side * side;
+    return (bytes + 63) / 64 * 64;
+  }
+}
+
+uint64_t DatasetCache::hash(const string &s)
+{
+  uint64_t h = 14695981039346656037ULL;
+  for (unsigned char c : s) {
+    h ^= c;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+bool DatasetCache::Writer::open(const string &filename, uint64_t settingsHash, int Lfp, int side)
+{
+  f.open(filename, ios::in | ios::out | ios::binary | ios::trunc);
+  if (!f.good()) return false;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, magic, sizeof(magic));
+  header.version = currentVersion;
+  header.byteOrder = byteOrderMark;
+  this->settingsHash = settingsHash;
+  header.Lfp = Lfp;
+  header.side = side;
+  f.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+  f.flush();
+  return f.good();
+}
+
+bool DatasetCache::Writer::append(const int box[4], const Eigen::VectorXd &pts, const cv::Mat &face)
+{
+  assert(pts.rows() == header.Lfp && face.rows == header.side && face.cols == header.side);
+  vector<char> record(recordBytes(header.Lfp, header.side), 0);
+  for (int j = 0; j < 4; ++j) {
+    int32_t v = box[j];
+    memcpy(&record[j * 4], &v, 4);
+  }
+  memcpy(&record[16], pts.data(), header.Lfp * sizeof(double));
+  char *pixels = &record[16 + header.Lfp * sizeof(double)];
+  for (int y = 0; y < header.side; ++y) {
+    memcpy(pixels + y * header.side, face.ptr<uint8_t>(y), header.side);
+  }
+  f.write(record.data(), record.size());
+  f.flush();
+  ++header.nfaces;
+  return f.good();
+}
+
+bool DatasetCache::Writer::close()
+{
+  header.settingsHash = settingsHash;
+  f.seekp(0);
+  f.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+  f.close();
+  return !f.fail();
+}
+
+bool DatasetCache::Reader::open(const string &filename)
+{
+  close();
+  if (!file.open(filename)) return false;
+
+  if (file.size() < sizeof(Header) || memcmp(header().magic, magic, sizeof(magic)) != 0
+      || header().version != currentVersion || header().byteOrder != byteOrderMark) {
+    cerr << "not a dataset cache: " << filename << endl;
+    close();
+    return false;
+  }
+  if (header().settingsHash == 0) {
+    cerr << "unfinished dataset cache: " << filename << endl;
+    close();
+    return false;
+  }
+  recordSize = recordBytes(header().Lfp, header().side);
+  if (sizeof(Header) + header().nfaces * recordSize > file.size()) {
+    cerr << "truncated dataset cache: " << filename << endl;
+    close();
+    return false;
+  }
+  return true;
+}
+
+cv::Mat DatasetCache::Reader::face(int i) const
+{
+  const int side = header().side;
+  char *pixels = const_cast<char *>(record(i) + 16 + header().Lfp * sizeof(double));
+  return cv::Mat(side, side, CV_8UC1, pixels, side);
+}
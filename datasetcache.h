@@ -0,0 +1,69 @@
+#pragma once
+
+#include "common.h"
+#include "numerical.hpp"
+#include "mappedfile.h"
+
+#include "opencv2/core/core.hpp"
+
+// Cache of a preprocessed training set: the faces cropped and scaled to a
+// fixed size, their points and the detected face boxes. All values are
+// little-endian and the records start at multiples of 64 bytes, a loaded cache
+// is used in place from a read-only memory mapping of the file:
+//
+//   Header
+//   for every face:
+//     int32_t[4]             face box in the source image, x1 y1 x2 y2
+//     double[Lfp]            points in the face image
+//     uint8_t[side * side]   grayscale face image, row major
+namespace DatasetCache {
+  const uint32_t currentVersion = 2;
+
+  struct Header {
+    char magic[8];          // "LBFFACES"
+    uint32_t version;
+    uint32_t byteOrder;     // 0x01020304 as written by the host
+    uint64_t settingsHash;  // hash of the settings the faces were made with, 0 until complete
+    int32_t nfaces;
+    int32_t Lfp;            // number of point coordinates of a face
+    int32_t side;           // width and height of the face images
+    int32_t reserved[7];
+  };
+  static_assert(sizeof(Header) == 64, "DatasetCache::Header must be 64 bytes");
+
+  // 64-bit FNV-1a hash, used for the settings of a cache
+  uint64_t hash(const string &s);
+
+  // writes the header on open and the faces one at a time. the settings hash
+  // and the number of faces are only set on close, an interrupted cache is
+  // rejected by the reader and rebuilt
+  class Writer {
+  public:
+    bool open(const string &filename, uint64_t settingsHash, int Lfp, int side);
+    bool append(const int box[4], const Eigen::VectorXd &pts, const cv::Mat &face);
+    bool close();
+
+  private:
+    fstream f;
+    Header header;
+    uint64_t settingsHash;
+  };
+
+  class Reader {
+  public:
+    bool open(const string &filename);
+    void close() { file.close(); }
+
+    const Header &header() const { return *reinterpret_cast<const Header *>(file.data()); }
+    const int32_t *box(int i) const { return reinterpret_cast<const int32_t *>(record(i)); }
+    const double *points(int i) const { return reinterpret_cast<const double *>(record(i) + 16); }
+    // a header for the pixels in the mapping, they must not be written
+    cv::Mat face(int i) const;
+
+  private:
+    const char *record(int i) const { return file.data() + sizeof(Header) + i * recordSize; }
+
+    MappedFile file;
+    size_t recordSize;
+  };
+}
@@ -33,7 +33,9 @@
 #include <algorithm>
 #include <iostream>
 #include <cmath>
+#include <cstring>
 #include <ctime>
+#include <map>
 
 #if defined (__APPLE__)
 #include <cv.h>
@@ -195,38 +197,129 @@ public:
     }
 };
 
-class FaceDetect::FaceDetectPriv
+/**
+ * Returns a copy of the header of a cascade that shares the stages, classifiers and features of
+ * the cascade, which OpenCV only reads. OpenCV keeps the data of the image being searched in
+ * hid_cascade, which it creates for the copy on its first detection, so the copy is used by
+ * one thread only. Release it with releaseCascadeHeader().
+ */
+static CvHaarClassifierCascade* cascadeHeader(const CvHaarClassifierCascade* src)
+{
+    if (!src)
+        return 0;
+
+    CvHaarClassifierCascade* dst = (CvHaarClassifierCascade*)cvAlloc(sizeof(CvHaarClassifierCascade));
+    memcpy(dst, src, sizeof(CvHaarClassifierCascade));
+    dst->hid_cascade = 0;
+
+    return dst;
+}
+
+/**
+ * Releases a copy of a cascade header and its hid_cascade, the shared stages are left to the
+ * cascade they belong to.
+ */
+static void releaseCascadeHeader(CvHaarClassifierCascade** cascade)
+{
+    // Without stages cvReleaseHaarClassifierCascade only frees hid_cascade and the header
+    (*cascade)->count = 0;
+    cvReleaseHaarClassifierCascade(cascade);
+}
+
+class DetectionContext::DetectionContextPriv
 {
 
 public:
 
-    FaceDetectPriv()
+    DetectionContextPriv()
     {
-        cascadeSet               = 0;
-        storage                  = 0;
-        scaleFactor              = 1.0;
+        generation    = 0;
+        scaleFactor   = 1.0;
 
-        maxDistance              = 0;
-        minDuplicates            = 0;
+        maxDistance   = 0;
+        minDuplicates = 0;
 
-        speedVsAccuracy          = 0.8;
-        sensitivityVsSpecificity = 0.8;
+        extractFaceImages = true;
     }
 
-    Haarcascades* cascadeSet;
-    CvMemStorage* storage;
+    ~DetectionContextPriv()
+    {
+        releaseCascades();
+    }
+
+    void releaseCascades()
+    {
+        for (unsigned int i = 0; i < cascades.size(); ++i)
+            if (cascades[i])
+                releaseCascadeHeader(&cascades[i]);
+        cascades.clear();
+        generation = 0;
+    }
+
+    unsigned long generation;     // The generation of the detector the cascades were copied from, 0 if none
+    vector<CvHaarClassifierCascade*> cascades;
+
     double        scaleFactor;    // Keeps the scaling factor of the internal image.
 
     int           maxDistance;    // Maximum distance between two faces to call them unique
     int           minDuplicates;  // Minimum number of duplicates required to qualify as a genuine face
 
-    vector<CascadeProperties> cascadeProperties;
+    bool          extractFaceImages;
+
     // Tunable values, for accuracy
     DetectObjectParameters primaryParams;
     DetectObjectParameters verifyingParams;
+};
+
+DetectionContext::DetectionContext()
+                : d(new DetectionContextPriv)
+{
+}
+
+DetectionContext::~DetectionContext()
+{
+    delete d;
+}
+
+void DetectionContext::setExtractFaceImages(bool extract)
+{
+    d->extractFaceImages = extract;
+}
+
+bool DetectionContext::extractFaceImages() const
+{
+    return d->extractFaceImages;
+}
+
+/**
+ * The generation of the last constructed detector. A detector is identified by its generation
+ * rather than its address, which a later detector can reuse.
+ */
+static unsigned long lastGeneration = 0;
+
+class FaceDetect::FaceDetectPriv
+{
+
+public:
+
+    FaceDetectPriv()
+    {
+        cascadeSet               = 0;
+        generation               = 0;
+
+        speedVsAccuracy          = 0.8;
+        sensitivityVsSpecificity = 0.8;
+    }
+
+    Haarcascades* cascadeSet;
+    unsigned long generation;
+
+    vector<CascadeProperties> cascadeProperties;
 
     double        speedVsAccuracy;
     double        sensitivityVsSpecificity;
+
+    DetectionContext defaultContext;  // Used by the detection methods without a context
 };
 
 FaceDetect::FaceDetect(const string& cascadeDir)
@@ -234,6 +327,9 @@ FaceDetect::FaceDetect(const string& cascadeDir)
 {
     d->cascadeSet = new Haarcascades(cascadeDir);
 
+    #pragma omp critical(libfaceGeneration)
+    d->generation = ++lastGeneration;
+
     /* Cascades */
 
     d->cascadeSet->addCascade("haarcascade_frontalface_alt.xml", 1);
@@ -271,7 +367,6 @@ FaceDetect::FaceDetect(const string& cascadeDir)
 
 FaceDetect::~FaceDetect()
 {
-    cvReleaseMemStorage(&d->storage);
     d->cascadeSet->clear();
     delete d->cascadeSet;
     delete d;
@@ -297,36 +392,37 @@ void FaceDetect::setSpecificity(double sensitivityVsSpecificity)
     d->sensitivityVsSpecificity = max(0.0, min(1.0, sensitivityVsSpecificity));
 }
 
-void FaceDetect::updateParameters(const CvSize& /*scaledSize*/, const CvSize& originalSize)
+void FaceDetect::updateParameters(DetectionContext& context, const CvSize& /*scaledSize*/, const CvSize& originalSize) const
 {
+    DetectionContext::DetectionContextPriv* const c = context.d;
     double origSize = double(max(originalSize.width, originalSize.height)) / 1000;
 
     /* Search increment will determine the number of passes over the image.
      * But with fewer passes, we will miss some faces.
      */
     if (d->speedVsAccuracy <= 0.159)
-        d->primaryParams.searchIncrement = 1.5;
+        c->primaryParams.searchIncrement = 1.5;
     else if (d->speedVsAccuracy >= 0.8)
-        d->primaryParams.searchIncrement = 1.1;
+        c->primaryParams.searchIncrement = 1.1;
     else
-        d->primaryParams.searchIncrement = round(100 * (1.1 - 0.5*log10(d->speedVsAccuracy))) / 100;
+        c->primaryParams.searchIncrement = round(100 * (1.1 - 0.5*log10(d->speedVsAccuracy))) / 100;
 
     /* This is a clear tradeoff. With 1, we'll get many faces,
      * but more false positives than faces.
      * 3 is the best parameter for normal use. */
     if (d->sensitivityVsSpecificity < 0.25)
-        d->primaryParams.grouping = 1;
+        c->primaryParams.grouping = 1;
     else if (d->sensitivityVsSpecificity < 0.5)
-        d->primaryParams.grouping = 2;
+        c->primaryParams.grouping = 2;
     else
-        d->primaryParams.grouping = 3;
+        c->primaryParams.grouping = 3;
 
     // flag speeds up (very much faster) and potentially lowers sensitivity: We mostly use it,
     // unless in we want very high sensitivity at low speed
     if (d->sensitivityVsSpecificity > 0.1 || d->speedVsAccuracy < 0.9)
-        d->primaryParams.flags = CV_HAAR_DO_CANNY_PRUNING;
+        c->primaryParams.flags = CV_HAAR_DO_CANNY_PRUNING;
     else
-        d->primaryParams.flags = 0;
+        c->primaryParams.flags = 0;
 
     /* greater min size will filter small images, lowering sensitivity, enhancing specificity,
      * with false positives often small */
@@ -340,23 +436,23 @@ void FaceDetect::updateParameters(const CvSize& /*scaledSize*/, const CvSize& or
     // Cascade minimum is 20 for most of our cascades (one is 24). Passing 0 will use the cascade minimum.
     if (minSize < 20)
         minSize = 0;
-    d->primaryParams.minSize = cvSize(lround(minSize), lround(minSize));
+    c->primaryParams.minSize = cvSize(lround(minSize), lround(minSize));
 
-    d->maxDistance   = 15;    // Maximum distance between two faces to call them unique
-    d->minDuplicates = 0;
+    c->maxDistance   = 15;    // Maximum distance between two faces to call them unique
+    c->minDuplicates = 0;
 
-    d->verifyingParams.searchIncrement = 1.1;
-    d->verifyingParams.flags           = 0;
+    c->verifyingParams.searchIncrement = 1.1;
+    c->verifyingParams.flags           = 0;
     // min size is adjusted each time
 
     if (DEBUG)
     {
         cout << "updateParameters: accuracy " << d->speedVsAccuracy
              << " sensitivity " << d->sensitivityVsSpecificity
-             << " - searchIncrement " << d->primaryParams.searchIncrement
-             << " grouping " << d->primaryParams.grouping
-             << " flags " << d->primaryParams.flags
-             << " min size " << d->primaryParams.minSize.width << endl
+             << " - searchIncrement " << c->primaryParams.searchIncrement
+             << " grouping " << c->primaryParams.grouping
+             << " flags " << c->primaryParams.flags
+             << " min size " << c->primaryParams.minSize.width << endl
              << " primary cascades: ";
 
         for (unsigned int i=0; i<d->cascadeProperties.size(); i++)
@@ -364,8 +460,8 @@ void FaceDetect::updateParameters(const CvSize& /*scaledSize*/, const CvSize& or
                 cout << d->cascadeSet->getCascade(i).name << " ";
 
         cout << endl
-             << " maxDistance " << d->maxDistance
-             << " minDuplicates " << d->minDuplicates << endl;
+             << " maxDistance " << c->maxDistance
+             << " minDuplicates " << c->minDuplicates << endl;
     }
 
     /*if (d->speedVsAccuracy < 0.5)
@@ -420,11 +516,22 @@ void FaceDetect::updateParameters(const CvSize& /*scaledSize*/, const CvSize& or
     */
 }
 
+void FaceDetect::prepareContext(DetectionContext& context) const
+{
+    if (context.d->generation == d->generation)
+        return;
+
+    context.d->releaseCascades();
+    for (int i = 0; i < d->cascadeSet->getSize(); ++i)
+        context.d->cascades.push_back(cascadeHeader(d->cascadeSet->getCascade(i).haarcasc));
+    context.d->generation = d->generation;
+}
+
 vector<Face> FaceDetect::cascadeResult(const IplImage* inputImage, CvHaarClassifierCascade* casc,
-                                       const DetectObjectParameters &params)
+                                       const DetectObjectParameters &params, CvMemStorage* storage) const
 {
-    // Clear the memory d->storage which was used before
-    cvClearMemStorage(d->storage);
+    // Clear the memory storage which was used before
+    cvClearMemStorage(storage);
 
     vector<Face> result;
 
@@ -451,7 +558,7 @@ vector<Face> FaceDetect::cascadeResult(const IplImage* inputImage, CvHaarClassif
 
     faces = cvHaarDetectObjects(inputImage,
             casc,
-            d->storage,
+            storage,
             params.searchIncrement,                // Increase search scale by 5% everytime
             params.grouping,                       // Drop groups of less than n detections
             params.flags,                          // Optionally, pre-test regions by edge detection
@@ -485,145 +592,175 @@ vector<Face> FaceDetect::cascadeResult(const IplImage* inputImage, CvHaarClassif
     return result;
 }
 
-bool FaceDetect::verifyFace(const IplImage* inputImage, const Face &face)
+bool FaceDetect::cascadeHit(DetectionContext& context, const IplImage* inputImage, const IplImage* extendedFaceImg,
+                            const Face &face, int cascade, CvMemStorage* storage) const
+{
+    const CvRect faceRect = cvRect(face.getX1(), face.getY1(), face.getWidth(), face.getHeight());
+    const CvSize faceSize = cvSize(face.getWidth(), face.getHeight());
+    const CascadeProperties& properties = d->cascadeProperties[cascade];
+
+    // The parameters are adjusted to the face, on a copy as cascades run in parallel
+    DetectObjectParameters params = context.d->verifyingParams;
+    params.minSize = properties.minSizeForFace(faceSize);
+
+    vector<Face> foundFaces;
+    if (properties.isFacialFeature())
+    {
+        params.grouping = 2;
+
+        CvRect roi = properties.faceROI(faceRect);
+        IplImage feature = LibFaceUtils::rectView(inputImage, roi);
+        foundFaces = cascadeResult(&feature, context.d->cascades[cascade], params, storage);
+
+        /*
+         * This is pretty much working code that scales up the face if it's too small
+         * for the  facial feature cascade. It did not bring me benefit with false positives though.
+        double factor = properties.requestedInputScaleFactor(faceSize);
+        IplImage* feature = LibFaceUtils::scaledSection(inputImage, roi, factor);
+
+        / *cout << "Facial feature in " << roi.x << " " << roi.y << " " << roi.width << "x" << roi.height
+             << " scaled up to " << feature->width << " " << feature->height << endl;* /
+        foundFaces = cascadeResult(feature, context.d->cascades[cascade], params, storage);
+
+        for (vector<Face>::iterator it = foundFaces.begin(); it != foundFaces.end(); ++it)
+        {
+            cout << "Feature face " << it->getX1() << " " << it->getY1() << " " << it->getWidth() << "x" << it->getHeight() << endl;
+            double widthScaled = it->getWidth() / factor;
+            double heightScaled = it->getHeight() / factor;
+
+            / *cout << "Hit feature size " << widthScaled << " " << heightScaled << " "
+                 << (faceSize.width / CascadeProperties::faceToFeatureRelationMin()) << " "
+                 << (faceSize.width / CascadeProperties::faceToFeatureRelationMax()) << endl;* /
+            if (
+                (widthScaled > faceSize.width / CascadeProperties::faceToFeatureRelationMin()
+                 && widthScaled < faceSize.width / CascadeProperties::faceToFeatureRelationMax())
+                ||
+                (heightScaled > faceSize.height / CascadeProperties::faceToFeatureRelationMin()
+                 && heightScaled < faceSize.height / CascadeProperties::faceToFeatureRelationMax())
+                )
+            {
+                return true;
+            }
+        }
+        */
+    }
+    else
+    {
+        params.grouping = 3;
+
+        // We dont need to check the size of found regions, the minSize in params is large enough
+        foundFaces = cascadeResult(extendedFaceImg, context.d->cascades[cascade], params, storage);
+    }
+
+    if (DEBUG)
+        cout << "Verifying cascade " << d->cascadeSet->getCascade(cascade).name << " gives "
+             << foundFaces.size() << endl;
+
+    return !foundFaces.empty();
+}
+
+vector<bool> FaceDetect::verifyFaces(DetectionContext& context, const IplImage* inputImage,
+                                     const vector<Face> &faces) const
 {
     // check if we need to verify
-    int verifyingCascades = 0;
+    vector<int> verifyingCascades;
     for (unsigned int i = 0; i < d->cascadeProperties.size(); ++i)
         if (d->cascadeProperties[i].verifyingCascade)
-            verifyingCascades++;
+            verifyingCascades.push_back(i);
 
-    if (!verifyingCascades)
-        return true;
+    if (verifyingCascades.empty())
+        return vector<bool>(faces.size(), true);
 
     clock_t detect;
     if (DEBUG)
         detect = clock();
 
     // Face coordinates. Add a certain margin for the other frontal cascades.
-    const CvRect faceRect = cvRect(face.getX1(), face.getY1(), face.getWidth(), face.getHeight());
-    const CvSize faceSize = cvSize(face.getWidth(), face.getHeight());
-    const int margin      = min(40, max(faceRect.width, faceRect.height));
+    // The cascades search views of the image, nothing is copied.
+    vector<IplImage> extendedFaceImgs(faces.size());
+    for (unsigned int f = 0; f < faces.size(); ++f)
+    {
+        const Face& face      = faces[f];
+        const CvRect faceRect = cvRect(face.getX1(), face.getY1(), face.getWidth(), face.getHeight());
+        const int margin      = min(40, max(faceRect.width, faceRect.height));
+
+        // Clip to bounds of image, after adding the margin
+        CvRect extendedRect   = cvRect( max(0, faceRect.x - margin),
+                                        max(0, faceRect.y - margin),
+                                        faceRect.width + 2*margin,
+                                        faceRect.height + 2*margin );
+        extendedRect.width  = min(inputImage->width - extendedRect.x, extendedRect.width);
+        extendedRect.height = min(inputImage->height - extendedRect.y, extendedRect.height);
 
-    // Clip to bounds of image, after adding the margin
-    CvRect extendedRect   = cvRect( max(0, faceRect.x - margin),
-                                    max(0, faceRect.y - margin),
-                                    faceRect.width + 2*margin,
-                                    faceRect.height + 2*margin );
-    extendedRect.width  = min(inputImage->width - extendedRect.x, extendedRect.width);
-    extendedRect.height = min(inputImage->height - extendedRect.y, extendedRect.height);
+        if (DEBUG)
+        {
+            cout << "\nVerifying face (" << face.getX1() << "," << face.getY1() << " "
+                 << face.getWidth() << "x" << face.getHeight() << ")" << endl;
+            cout << "extended rect " << extendedRect.x << " " << extendedRect.y
+                 << " " << extendedRect.width << "x" << extendedRect.height << endl;
+        }
 
-    if (DEBUG)
-    {
-        cout << "\nVerifying face (" << face.getX1() << "," << face.getY1() << " "
-             << face.getWidth() << "x" << face.getHeight() << ")" << endl;
-        cout << "extended rect " << extendedRect.x << " " << extendedRect.y
-             << " " << extendedRect.width << "x" << extendedRect.height << endl;
+        extendedFaceImgs[f] = LibFaceUtils::rectView(inputImage, extendedRect);
     }
 
-    IplImage* extendedFaceImg = LibFaceUtils::copyRect(inputImage, extendedRect);
-    vector<Face> foundFaces;
-    //LibFaceUtils::showImage(extendedFaceImg, foundFaces);
+    // A cascade keeps scratch data of the image it is applied to, so the context's copy
+    // of a cascade must not be used by two threads at once. Every verifying cascade is one task that
+    // checks all faces with its own memory storage and writes its own row of hits.
+    vector<vector<char> > hits(verifyingCascades.size(), vector<char>(faces.size(), 0));
 
-    int frontalFaceVotes = 0, facialFeatureVotes = 0;
-    for (int i = 0; i < d->cascadeSet->getSize(); ++i)
+    #pragma omp parallel for schedule(dynamic)
+    for (int c = 0; c < (int)verifyingCascades.size(); ++c)
     {
-        if (d->cascadeProperties[i].verifyingCascade)
-        {
-            d->verifyingParams.minSize = d->cascadeProperties[i].minSizeForFace(faceSize);
+        CvMemStorage* storage = cvCreateMemStorage(0);
+        for (unsigned int f = 0; f < faces.size(); ++f)
+            hits[c][f] = cascadeHit(context, inputImage, &extendedFaceImgs[f], faces[f], verifyingCascades[c], storage);
+        cvReleaseMemStorage(&storage);
+    }
 
-            if (d->cascadeProperties[i].isFacialFeature())
-            {
-                d->verifyingParams.grouping = 2;
-
-                CvRect roi = d->cascadeProperties[i].faceROI(faceRect);
-                IplImage* feature = LibFaceUtils::copyRect(inputImage, roi);
-                foundFaces = cascadeResult(feature, d->cascadeSet->getCascade(i).haarcasc, d->verifyingParams);
-                if (foundFaces.size())
-                    facialFeatureVotes++;
-
-                /*
-                 * This is pretty much working code that scales up the face if it's too small
-                 * for the  facial feature cascade. It did not bring me benefit with false positives though.
-                double factor = d->cascadeProperties[i].requestedInputScaleFactor(faceSize);
-                IplImage* feature = LibFaceUtils::scaledSection(inputImage, roi, factor);
-
-                / *cout << "Facial feature in " << roi.x << " " << roi.y << " " << roi.width << "x" << roi.height
-                     << " scaled up to " << feature->width << " " << feature->height << endl;* /
-                foundFaces = cascadeResult(feature, d->cascadeSet->getCascade(i).haarcasc, d->verifyingParams);
-
-                for (vector<Face>::iterator it = foundFaces.begin(); it != foundFaces.end(); ++it)
-                {
-                    cout << "Feature face " << it->getX1() << " " << it->getY1() << " " << it->getWidth() << "x" << it->getHeight() << endl;
-                    double widthScaled = it->getWidth() / factor;
-                    double heightScaled = it->getHeight() / factor;
-
-                    / *cout << "Hit feature size " << widthScaled << " " << heightScaled << " "
-                         << (faceSize.width / CascadeProperties::faceToFeatureRelationMin()) << " "
-                         << (faceSize.width / CascadeProperties::faceToFeatureRelationMax()) << endl;* /
-                    if (
-                        (widthScaled > faceSize.width / CascadeProperties::faceToFeatureRelationMin()
-                         && widthScaled < faceSize.width / CascadeProperties::faceToFeatureRelationMax())
-                        ||
-                        (heightScaled > faceSize.height / CascadeProperties::faceToFeatureRelationMin()
-                         && heightScaled < faceSize.height / CascadeProperties::faceToFeatureRelationMax())
-                        )
-                    {
-                        facialFeatureVotes++;
-                        cout << "voting" << endl;
-                        break;
-                    }
-                }
-                */
-
-                cvReleaseImage(&feature);
-            }
+    // Count the votes of every face in cascade order
+    vector<bool> verified(faces.size());
+    for (unsigned int f = 0; f < faces.size(); ++f)
+    {
+        int frontalFaceVotes = 0, facialFeatureVotes = 0;
+        for (unsigned int c = 0; c < verifyingCascades.size(); ++c)
+        {
+            if (!hits[c][f])
+                continue;
+            if (d->cascadeProperties[verifyingCascades[c]].isFacialFeature())
+                facialFeatureVotes++;
             else
-            {
-                d->verifyingParams.grouping = 3;
-
-                foundFaces = cascadeResult(extendedFaceImg, d->cascadeSet->getCascade(i).haarcasc, d->verifyingParams);
-
-                // We dont need to check the size of found regions, the minSize in verifyingParams is large enough
-                if (foundFaces.size())
-                    frontalFaceVotes++;
-            }
-
-            if (DEBUG)
-                cout << "Verifying cascade " << d->cascadeSet->getCascade(i).name << " gives "
-                     << foundFaces.size() << endl;
+                frontalFaceVotes++;
         }
-    }
 
-    cvReleaseImage(&extendedFaceImg);
-
-    bool verified;
-    // Heuristic: Discard a sufficiently large face that shows no facial features
-    if (faceSize.width <= 50 && facialFeatureVotes == 0)
-        verified = false;
-    else
-    {
-        if (frontalFaceVotes && facialFeatureVotes)
-            verified = true;
-        else if (frontalFaceVotes >= 2)
-            verified = true;
-        else if (facialFeatureVotes >= 2)
-            verified = true;
+        // Heuristic: Discard a sufficiently large face that shows no facial features
+        if (faces[f].getWidth() <= 50 && facialFeatureVotes == 0)
+            verified[f] = false;
         else
-            verified = false;
+        {
+            if (frontalFaceVotes && facialFeatureVotes)
+                verified[f] = true;
+            else if (frontalFaceVotes >= 2)
+                verified[f] = true;
+            else if (facialFeatureVotes >= 2)
+                verified[f] = true;
+            else
+                verified[f] = false;
+        }
+
+        if (DEBUG)
+            cout << "Votes of face " << f << ": Frontal " << frontalFaceVotes << " " << " Features " << facialFeatureVotes
+                 << ". Face verified: " << verified[f] << endl;
     }
 
     if (DEBUG)
     {
         detect = clock() - detect;
-        cout << "Verification finished in " << ((double)detect / ((double)CLOCKS_PER_SEC))
-             << ". Votes: Frontal " << frontalFaceVotes << " " << " Features " << facialFeatureVotes
-             << ". Face verified: " << verified << endl;
+        cout << "Verification finished in " << ((double)detect / ((double)CLOCKS_PER_SEC)) << endl;
     }
     return verified;
 }
 
-vector<Face> FaceDetect::mergeFaces(const IplImage* /*inputImage*/, vector<vector<Face> > combo, int maxdist, int mindups)
+vector<Face> FaceDetect::mergeFaces(const IplImage* /*inputImage*/, const vector<vector<Face> >& combo, int maxdist, int mindups) const
 {
     clock_t      finalStage;
     vector<Face> finalResult;
@@ -643,50 +780,14 @@ vector<Face> FaceDetect::mergeFaces(const IplImage* /*inputImage*/, vector<vecto
 
     if (primaryCascades > 1)
     {
-        if (DEBUG)
-            finalStage = clock() - finalStage;
-
-        /*
-        Now, starting from the left, take a face and compare with rest. If distance is less than a threshold,
-        consider them to be "overlapping" face frames and delete the "duplicate" from the vector.
-        Remember that only faces to the RIGHT of the reference face will be deleted.
-        */
-        vector<int> genuineness;
         if (DEBUG)
             finalStage = clock();
 
-        int ctr = 0;
-        for (unsigned int i = 0; i < finalResult.size(); ++i)
-        {
-            int duplicates = 0;
-            for (unsigned int j = i + 1; j < finalResult.size(); ++j)    // Compare with the faces to the right
-            {
-                ctr++;
-                if (LibFaceUtils::distance(finalResult[i], finalResult[j]) < maxdist)
-                {
-                    finalResult.erase(finalResult.begin() + j);
-                    duplicates++;
-                    j--;
-
-                }
-            }
-            genuineness.push_back(duplicates);
-            if (duplicates < mindups)    // Less duplicates, probably not genuine, kick it out
-            {
-                genuineness.erase(genuineness.begin() + i);
-                finalResult.erase(finalResult.begin() + i);
-                i--;
-            }
-        }
-
-        /*
-        Note that the index of the reference element will be the same as the index of it's number of duplicates
-        in the genuineness vector, so win-win!.
-        */
+        finalResult = LibFaceUtils::mergeDuplicates(finalResult, maxdist, mindups);
 
         if (DEBUG)
         {
-            printf("Faces parsed : %d, number of final faces : %d\n", ctr, (int)genuineness.size());
+            printf("Number of final faces : %d\n", (int)finalResult.size());
             finalStage = clock() - finalStage;
             printf("Pruning took: %f sec.\n", (double)finalStage / ((double)CLOCKS_PER_SEC));
         }
@@ -695,12 +796,23 @@ vector<Face> FaceDetect::mergeFaces(const IplImage* /*inputImage*/, vector<vecto
     return finalResult;
 }
 
+IplImage* FaceDetect::faceImage(const IplImage* inputImage, const Face& face)
+{
+    CvRect rect = cvRect(face.getX1(), face.getY1(), face.getWidth(), face.getHeight());
+    return LibFaceUtils::copyRect(inputImage, rect);
+}
+
 int FaceDetect::getRecommendedImageSizeForDetection()
 {
     return 800;
 }
 
 vector<Face> FaceDetect::detectFaces(const IplImage* inputImage, const CvSize& size)
+{
+    return detectFaces(d->defaultContext, inputImage, size);
+}
+
+vector<Face> FaceDetect::detectFaces(DetectionContext& context, const IplImage* inputImage, const CvSize& size) const
 {
     if (inputImage->imageData == 0)
     {
@@ -717,8 +829,11 @@ vector<Face> FaceDetect::detectFaces(const IplImage* inputImage, const CvSize& s
     if (DEBUG)
         init = clock();
 
+    prepareContext(context);
+    DetectionContext::DetectionContextPriv* const c = context.d;
+
     IplImage* scaled = 0;
-    d->scaleFactor   = 1;
+    c->scaleFactor   = 1;
 
     int inputArea  = inputImage->width*inputImage->height;
 
@@ -729,19 +844,20 @@ vector<Face> FaceDetect::detectFaces(const IplImage* inputImage, const CvSize& s
     {
         if (DEBUG)
             cout << "downscaling input image" << endl;
-        scaled = libface::LibFaceUtils::resizeToArea(inputImage, 786432, d->scaleFactor);
+        scaled = libface::LibFaceUtils::resizeToArea(inputImage, 786432, c->scaleFactor);
     }
 
     const IplImage* image = scaled ? scaled : inputImage;
 
-    updateParameters(cvSize(image->width, image->height), originalSize);
+    updateParameters(context, cvSize(image->width, image->height), originalSize);
 
-    // Now loop through each cascade, apply it, and get back a vector of detected faces
+    // Now loop through each cascade, apply it, and get back a vector of detected faces.
+    // The primary cascades run in parallel, each with its own memory storage, and
+    // every cascade writes its own slot, so the faces are merged in cascade order.
     vector<vector<Face> > primaryResults(d->cascadeSet->getSize());
     vector<Face> finalResult;
 
-    d->storage = cvCreateMemStorage(0);
-
+    #pragma omp parallel for schedule(dynamic) private(detect, duration)
     for (int i = 0; i < d->cascadeSet->getSize(); ++i)
     {
         if (d->cascadeProperties[i].primaryCascade)
@@ -749,7 +865,9 @@ vector<Face> FaceDetect::detectFaces(const IplImage* inputImage, const CvSize& s
             if (DEBUG)
                 detect = clock();
 
-            primaryResults[i] = cascadeResult(image, d->cascadeSet->getCascade(i).haarcasc, d->primaryParams);
+            CvMemStorage* storage = cvCreateMemStorage(0);
+            primaryResults[i] = cascadeResult(image, c->cascades[i], c->primaryParams, storage);
+            cvReleaseMemStorage(&storage);
 
             if (DEBUG)
             {
@@ -762,19 +880,17 @@ vector<Face> FaceDetect::detectFaces(const IplImage* inputImage, const CvSize& s
 
     // After intelligently "merging" overlaps of face regions by different cascades,
     // this creates a list of faces.
-    finalResult = mergeFaces(image, primaryResults, d->maxDistance, d->minDuplicates);
+    finalResult = mergeFaces(image, primaryResults, c->maxDistance, c->minDuplicates);
     //LibFaceUtils::showImage(image, finalResult);
 
     // Verify faces using other cascades
-    for (vector<Face>::iterator it = finalResult.begin(); it != finalResult.end(); )
-    {
-        if (!verifyFace(image, *it))
-            it = finalResult.erase(it);
-        else
-            ++it;
-    }
+    vector<bool> verified = verifyFaces(context, image, finalResult);
+    vector<Face> verifiedFaces;
+    for (unsigned int i = 0; i < finalResult.size(); ++i)
+        if (verified[i])
+            verifiedFaces.push_back(finalResult[i]);
+    finalResult.swap(verifiedFaces);
 
-    cvReleaseMemStorage(&d->storage);
     if (scaled)
         cvReleaseImage(&scaled);
 
@@ -782,18 +898,17 @@ vector<Face> FaceDetect::detectFaces(const IplImage* inputImage, const CvSize& s
     for (vector<Face>::iterator it = finalResult.begin(); it != finalResult.end(); ++it)
     {
         // rescale to full image
-        if (d->scaleFactor != 1)
+        if (c->scaleFactor != 1)
         {
-            it->setX1(lround(it->getX1() * d->scaleFactor));
-            it->setY1(lround(it->getY1() * d->scaleFactor));
-            it->setX2(lround(it->getX2() * d->scaleFactor));
-            it->setY2(lround(it->getY2() * d->scaleFactor));
+            it->setX1(lround(it->getX1() * c->scaleFactor));
+            it->setY1(lround(it->getY1() * c->scaleFactor));
+            it->setX2(lround(it->getX2() * c->scaleFactor));
+            it->setY2(lround(it->getY2() * c->scaleFactor));
         }
 
         //Extract face-image from whole-image.
-        CvRect rect       = cvRect(it->getX1(), it->getY1(), it->getWidth(), it->getHeight());
-        IplImage* faceImg = LibFaceUtils::copyRect(inputImage, rect);
-        it->setFace(faceImg);
+        if (c->extractFaceImages)
+            it->setFace(faceImage(inputImage, *it));
     }
 
     if (DEBUG)
@@ -41,6 +41,41 @@ namespace libface
 {
 
 class DetectObjectParameters;
+class FaceDetect;
+
+/**
+ * Scratch state of face detections: the parameters adjusted to the current image and private
+ * cascade headers, whose data of the searched image OpenCV modifies while it detects. A
+ * FaceDetect can be shared by many threads as long as every thread detects with its own context.
+ *
+ * The stages, classifiers and features of the cascades are loaded once and shared by all
+ * contexts of a detector. A context only adds the headers and the data OpenCV derives from
+ * the cascades for the searched image. A context must not detect after its detector is destroyed.
+ */
+class FACEAPI DetectionContext
+{
+public:
+
+    DetectionContext();
+    ~DetectionContext();
+
+    /**
+     * Sets whether the detected faces get a copy of their image region, see Face::getFace().
+     * On by default. Without it the face images can be cropped when needed with FaceDetect::faceImage().
+     */
+    void setExtractFaceImages(bool extract);
+    bool extractFaceImages() const;
+
+private:
+
+    DetectionContext(const DetectionContext&);
+    DetectionContext& operator=(const DetectionContext&);
+
+    friend class FaceDetect;
+
+    class DetectionContextPriv;
+    DetectionContextPriv* const d;
+};
 
 class FACEAPI FaceDetect : public LibFaceDetectCore
 {
@@ -56,12 +91,25 @@ public:
     FaceDetect(const std::string& cascadeDir);
 
     /**
-     *   Default destructor. Clears up Haarcascades and frees memory d->storage.
+     *   Default destructor. Clears up Haarcascades.
      */
     ~FaceDetect();
 
     /**
-     * Detects faces in an input image
+     * Detects faces in an input image. The detector is not modified, so threads can share it
+     * when each of them passes its own context.
+     *
+     * @param context The scratch state of the calling thread
+     * @param inputImage A pointer to the image in which faces are to be detected
+     * @return The vector of detected faces
+     */
+    std::vector<Face> detectFaces(DetectionContext& context, const IplImage* inputImage,
+                                  const CvSize& originalSize = cvSize(0,0)) const;
+
+    /**
+     * Detects faces in an input image with the context of the detector itself.
+     * Not thread-safe, use the overload taking a context for that.
+     *
      * @param inputImage A pointer to the image in which faces are to be detected
      * @return The vector of detected faces
      */
@@ -69,7 +117,7 @@ public:
 
     /**
      * Inherited method from LibFaceDetectCore. A slightly different interface where you can specify
-     * full path to image.
+     * full path to image. Not thread-safe.
      *
      * @param filename A full path to the image.
      * @return Returns a vector of Face objects. Each object hold information about 1 face.
@@ -84,6 +132,7 @@ public:
      * The value is in the interval [0;1], where 0 means
      * fastest operation and highest sensitivity while 1
      * means best accuracy (slow operation) and high specificity.
+     * Tune the detector before it is shared by threads.
      */
     void setAccuracy(double speedVsAccuracy);
     void setSpecificity(double sensitivityVsSpecificity);
@@ -97,6 +146,15 @@ public:
      */
     static int getRecommendedImageSizeForDetection();
 
+    /**
+     * Returns a copy of the region of a detected face.
+     * Note: The caller owns the image and releases it after use
+     *
+     * @param inputImage The image the face was detected in
+     * @param face The detected face
+     */
+    static IplImage* faceImage(const IplImage* inputImage, const Face& face);
+
 private:
 
     /**
@@ -105,11 +163,32 @@ private:
      *  @param inputImage A pointer to the IplImage representing image of interest.
      *  @param casc The CvClassClassifierCascade pointer to be used for the detection
      *  @param params The parameters to be used for detection
+     *  @param storage The memory storage used by the detection, it is cleared first
      *  @return Returns a vector of Face objects. Each object hold information about 1 face.
      */
-    std::vector<Face> cascadeResult(const IplImage* inputImage, CvHaarClassifierCascade* casc, const DetectObjectParameters& params);
+    std::vector<Face> cascadeResult(const IplImage* inputImage, CvHaarClassifierCascade* casc,
+                                    const DetectObjectParameters& params, CvMemStorage* storage) const;
 
-    bool verifyFace(const IplImage* inputImage, const Face &face);
+    /**
+     * Returns whether a verifying cascade finds a face, or its facial feature, in the
+     * region of a face.
+     *
+     * @param inputImage The image the face was detected in
+     * @param extendedFaceImg A view of the face region with a margin, used by frontal face cascades
+     * @param face The face to verify
+     * @param cascade The index of the verifying cascade
+     * @param storage The memory storage used by the detection
+     */
+    bool cascadeHit(DetectionContext& context, const IplImage* inputImage, const IplImage* extendedFaceImg,
+                    const Face &face, int cascade, CvMemStorage* storage) const;
+
+    /**
+     * Verifies the faces with the verifying cascades, which run in parallel.
+     *
+     * @return For every face whether it is verified
+     */
+    std::vector<bool> verifyFaces(DetectionContext& context, const IplImage* inputImage,
+                                  const std::vector<Face> &faces) const;
 
     /**
      * Returns the faces from the detection results of multiple cascades
@@ -117,11 +196,16 @@ private:
      * @param combo A vector of a vector of faces, each component vector is the detection result of a single cascade
      * @param maxdist The maximum allowable distance between two duplicates, if two faces are further apart than this, they are not duplicates
      * @param mindups The minimum number of duplicate detections required for a face to qualify as genuine
-     * @return The vector of the final faces
+     * @return The vector of the final faces, in the order of the detections
+     */
+    std::vector<Face> mergeFaces(const IplImage*, const std::vector< std::vector<Face> >& combo, int maxdist, int mindups) const;
+
+    /**
+     * Copies the cascades of this detector into the context, unless it holds them already.
      */
-    std::vector<Face> mergeFaces(const IplImage*, std::vector< std::vector<Face> >, int maxdist, int mindups);
+    void prepareContext(DetectionContext& context) const;
 
-    void updateParameters(const CvSize& scaledSize, const CvSize& originalSize);
+    void updateParameters(DetectionContext& context, const CvSize& scaledSize, const CvSize& originalSize) const;
 
 private:
 
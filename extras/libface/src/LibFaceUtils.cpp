@@ -30,8 +30,10 @@
  *
  * ============================================================ */
 
+#include <algorithm>
 #include <iostream>
 #include <cmath>
+#include <map>
 
 #include "LibFaceUtils.h"
 
@@ -115,6 +117,71 @@ int LibFaceUtils::distance(const Face& f1, const Face& f2)
     return distance(p1,p2);
 }
 
+/**
+ * Merges duplicate detections. Starting from the left, a face is compared with the faces to its
+ * RIGHT that are not merged yet, and those closer than maxdist are merged into it. A face is kept
+ * if it has at least mindups duplicates.
+ *
+ * Duplicates are closer than maxdist in both directions, so the centers are put in a grid of
+ * maxdist cells and only the faces in the neighbouring cells are compared.
+ *
+ * @param faces The faces, in the order of the detections
+ * @param maxdist The maximum allowable distance between two duplicates
+ * @param mindups The minimum number of duplicates required for a face to qualify as genuine
+ * @return The genuine faces, in the order of the detections
+ */
+vector<Face> LibFaceUtils::mergeDuplicates(const vector<Face>& faces, int maxdist, int mindups)
+{
+    const int cellSize = max(maxdist, 1);
+
+    map<pair<int, int>, vector<int> > grid;
+    vector<pair<int, int> > cells(faces.size());
+    for (unsigned int i = 0; i < faces.size(); ++i)
+    {
+        CvPoint c = center(faces[i]);
+        cells[i]  = make_pair((int)floor(double(c.x) / cellSize), (int)floor(double(c.y) / cellSize));
+        grid[cells[i]].push_back(i);
+    }
+
+    vector<char> merged(faces.size(), 0);
+    vector<Face> genuineFaces;
+
+    for (unsigned int i = 0; i < faces.size(); ++i)
+    {
+        if (merged[i])
+            continue;
+
+        int duplicates = 0;
+        for (int dy = -1; dy <= 1; ++dy)
+        {
+            for (int dx = -1; dx <= 1; ++dx)
+            {
+                map<pair<int, int>, vector<int> >::const_iterator cell =
+                    grid.find(make_pair(cells[i].first + dx, cells[i].second + dy));
+                if (cell == grid.end())
+                    continue;
+
+                // Compare with the faces to the right
+                const vector<int>& candidates = cell->second;
+                for (vector<int>::const_iterator j = upper_bound(candidates.begin(), candidates.end(), (int)i);
+                     j != candidates.end(); ++j)
+                {
+                    if (!merged[*j] && distance(faces[i], faces[*j]) < maxdist)
+                    {
+                        merged[*j] = 1;
+                        duplicates++;
+                    }
+                }
+            }
+        }
+
+        if (duplicates >= mindups)    // Less duplicates, probably not genuine, kick it out
+            genuineFaces.push_back(faces[i]);
+    }
+
+    return genuineFaces;
+}
+
 /**
  * Method for reshaping a matrix into a single coloumn vector.
  *
@@ -656,6 +723,33 @@ IplImage* LibFaceUtils::copyRect(const IplImage* src, const CvRect& rect)
     return result;
 }
 
+/**
+ * Returns an image header on a rectangle of the source image, sharing its data.
+ * Nothing is allocated, the view is valid as long as the source image.
+ *
+ * @param src The source image
+ * @param rect The rectangle, it is clipped to the bounds of the image
+ * @return The header of the view
+ */
+IplImage LibFaceUtils::rectView(const IplImage* src, const CvRect& rect)
+{
+    const int x1 = max(0, rect.x);
+    const int y1 = max(0, rect.y);
+    const int x2 = max(x1, min(src->width, rect.x + rect.width));
+    const int y2 = max(y1, min(src->height, rect.y + rect.height));
+
+    IplImage view;
+    cvInitImageHeader(&view, cvSize(x2 - x1, y2 - y1), src->depth, src->nChannels);
+
+    // Rows keep the stride of the source image
+    view.widthStep = src->widthStep;
+    view.imageSize = view.height * src->widthStep;
+    view.imageData = const_cast<char*>(src->imageData) + y1 * src->widthStep
+                     + x1 * src->nChannels * ((src->depth & 255) / 8);
+
+    return view;
+}
+
 IplImage* LibFaceUtils::scaledSection(const IplImage* src, const CvRect& sourceRect, double scaleFactor)
 {
     if (scaleFactor == 1.0)
@@ -60,6 +60,7 @@ public:
     static CvPoint     center(const Face&);
     static int         distance(CvPoint, CvPoint);
     static int         distance(const Face&, const Face&);
+    static std::vector<Face> mergeDuplicates(const std::vector<Face>& faces, int maxdist, int mindups);
 
     static CvMat*      addScalar(CvMat* src, CvScalar value);
     static CvMat*      combine(CvMat* src, CvMat* vector);
@@ -80,6 +81,7 @@ public:
     static CvMat*      transpose(CvMat* src);
     static IplImage*   charToIplImage(const char* img, int width, int height, int step, int depth, int channels);
     static IplImage*   copyRect(const IplImage* src, const CvRect& rect);
+    static IplImage    rectView(const IplImage* src, const CvRect& rect);
     static IplImage*   scaledSection(const IplImage* src, const CvRect& sourceRect, double scaleFactor);
     static IplImage*   scaledSection(const IplImage* src, const CvRect& sourceRect, const CvSize& destSize);
 
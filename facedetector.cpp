@@ -1,4 +1,77 @@
 #include "facedetector.h"
 
 FaceDetector::FaceDetector()
-{}
\ No newline at end of file
+{
+  // only the boxes are used, the face images are not copied
+  context.setExtractFaceImages(false);
+}
+
+FaceDetector::~FaceDetector()
+{}
+
+FaceDetector &FaceDetector::threadInstance()
+{
+  // the context keeps per-call state, so every thread owns a detector
+  static thread_local FaceDetector detector;
+  return detector;
+}
+
+const FaceDetect &FaceDetector::sharedDetect()
+{
+#ifdef WIN32
+  static const FaceDetect detect(string(OPENCVDIR) + "/data/haarcascades");
+#else
+  static const FaceDetect detect(string(OPENCVDIR) + "/haarcascades");
+#endif
+  return detect;
+}
+
+vector<FaceDetector::BoundingBox> FaceDetector::detect(const cv::Mat &img)
+{
+  /* the cascades work on b&w images */
+  cv::Mat gray;
+  if (img.channels() >= 3)
+    cv::cvtColor(img, gray, CV_BGR2GRAY);
+  else
+    gray = img;
+
+  IplImage pimg = IplImage(gray);
+  vector<Face> result = sharedDetect().detectFaces(context, &pimg, cvSize(pimg.width, pimg.height));
+
+  vector<BoundingBox> detectedFaces;
+  for (int i = 0; i < result.size(); i++)
+  {
+    Face &face = result[i];
+    BoundingBox bb;
+    bb.ul.x = face.getX1(); bb.ul.y = face.getY1();
+    bb.lr.x = face.getX2(); bb.lr.y = face.getY2();
+    detectedFaces.push_back(bb);
+  }
+  return detectedFaces;
+}
+
+vector<FaceDetector::BoundingBox> FaceDetector::detectFace(const string &filename)
+{
+  cout << "detecting face ..." << endl;
+
+  /* read the input image */
+  cv::Mat image = cv::imread(filename, CV_LOAD_IMAGE_COLOR);
+  if (image.empty()) return vector<BoundingBox>();
+
+  vector<BoundingBox> detectedFaces = threadInstance().detect(image);
+
+  cout << "detected faces: " << detectedFaces.size() << endl;
+  /* go through all the detected faces, and draw them into the input image */
+  for (auto &bb : detectedFaces)
+  {
+    cout << bb.ul.x << ", " << bb.ul.y << ", " << bb.lr.x << ", " << bb.lr.y << endl;
+    cv::rectangle(image, bb.ul, bb.lr, cv::Scalar(0, 0, 255), 3, 8, 0);
+  }
+
+  /* show the result and wait for a keystroke form user before finishing */
+  cv::imshow("result", image);
+  cv::waitKey(0);
+  cv::destroyWindow("result");
+
+  return detectedFaces;
+}
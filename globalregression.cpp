@@ -0,0 +1,190 @@
+#include "globalregression.h"
+
+#include "extras/liblinear/linear.h"
+
+#include <cstring>
+
+namespace {
+  void silent(const char *) {}
+
+  // state of rand() of the calling thread
+  thread_local std::mt19937 randState;
+}
+
+// liblinear's dual solver shuffles with rand(). these replace the C library's
+// rand() and srand() with a generator per thread, so the outputs solved in
+// parallel by trainSVR do not share one sequence
+extern "C" int rand()
+{
+  return (int)(randState() >> 1);
+}
+
+extern "C" void srand(unsigned int seed)
+{
+  randState.seed(seed);
+}
+
+bool GlobalRegression::trainSVR(const BinaryFeatures &features, const Eigen::MatrixXd &targets, double C, double eps,
+                                unsigned int seed, RowMatrixXd &W)
+{
+  const int nsamples = features.rows(), ntrees = features.ntrees, nleaves = features.nleaves;
+  assert(targets.rows() == nsamples);
+
+  // one row of feature nodes per sample, 1-based indices of the active leaves
+  // terminated by index -1
+  vector<feature_node> nodes((size_t)nsamples * (ntrees + 1));
+  vector<feature_node*> x(nsamples);
+  for (int i = 0; i < nsamples; ++i) {
+    x[i] = &nodes[(size_t)i * (ntrees + 1)];
+    for (int k = 0; k < ntrees; ++k) {
+      x[i][k].index = k * nleaves + features.leaves(i, k) + 1;
+      x[i][k].value = 1.0;
+    }
+    x[i][ntrees].index = -1;
+    x[i][ntrees].value = 0;
+  }
+
+  set_print_string_function(silent);
+
+  parameter param;
+  memset(&param, 0, sizeof(param));
+  param.solver_type = L2R_L2LOSS_SVR_DUAL;
+  param.C = C;
+  param.p = 0;
+  param.eps = eps;
+
+  // the parameters are the same for all outputs, check them once
+  {
+    problem prob;
+    prob.l = nsamples;
+    prob.n = features.dims();
+    prob.y = nullptr;
+    prob.x = x.data();
+    prob.bias = -1;
+    const char *error = check_parameter(&prob, &param);
+    if (error != nullptr) {
+      cerr << "invalid liblinear parameters: " << error << endl;
+      return false;
+    }
+  }
+
+  W.resize(features.dims(), targets.cols());
+
+  #pragma omp parallel for schedule(dynamic)
+  for (int c = 0; c < targets.cols(); ++c) {
+    vector<double> y(targets.col(c).data(), targets.col(c).data() + nsamples);
+
+    problem prob;
+    prob.l = nsamples;
+    prob.n = features.dims();
+    prob.y = y.data();
+    prob.x = x.data();
+    prob.bias = -1;
+
+    // the shuffling of the solver only depends on the seed and the output,
+    // rand() is per thread
+    std::seed_seq seq{ seed, (unsigned int)c };
+    unsigned int cseed;
+    seq.generate(&cseed, &cseed + 1);
+    srand(cseed);
+
+    model *m = ::train(&prob, &param);
+    for (int j = 0; j < features.dims(); ++j) W(j, c) = m->w[j];
+    free_and_destroy_model(&m);
+  }
+  return true;
+}
+
+RowMatrixXd GlobalRegression::trainRidge(const BinaryFeatures &features, const Eigen::MatrixXd &targets, double lambda, int iterations)
+{
+  const int nsamples = features.rows(), ntrees = features.ntrees, nleaves = features.nleaves;
+  assert(targets.rows() == nsamples);
+
+  RowMatrixXd W = RowMatrixXd::Zero(features.dims(), targets.cols());
+
+  // number of samples reaching each leaf
+  Eigen::MatrixXi counts = Eigen::MatrixXi::Zero(nleaves, ntrees);
+  for (int k = 0; k < ntrees; ++k) {
+    for (int i = 0; i < nsamples; ++i) ++counts(features.leaves(i, k), k);
+  }
+
+  // the output coordinates are independent problems
+  #pragma omp parallel for schedule(dynamic)
+  for (int c = 0; c < targets.cols(); ++c) {
+    Eigen::VectorXd residual = targets.col(c);
+    Eigen::VectorXd sums(nleaves), delta(nleaves);
+    for (int iter = 0; iter < iterations; ++iter) {
+      for (int k = 0; k < ntrees; ++k) {
+        const uint16_t *leaves = features.leaves.col(k).data();
+        sums.setZero();
+        for (int i = 0; i < nsamples; ++i) sums[leaves[i]] += residual[i];
+
+        // optimal weight of each leaf given the other trees
+        for (int j = 0; j < nleaves; ++j) {
+          double &w = W(k * nleaves + j, c);
+          double wnew = (sums[j] + counts(j, k) * w) / (counts(j, k) + lambda);
+          delta[j] = wnew - w;
+          w = wnew;
+        }
+        for (int i = 0; i < nsamples; ++i) residual[i] -= delta[leaves[i]];
+      }
+    }
+  }
+  return W;
+}
+
+void QuantizedRowMatrix::quantize(const RowMatrixXd &W)
+{
+  const double maxval = numeric_limits<int16_t>::max();
+  values.resize(W.rows(), W.cols());
+  scales.resize(W.rows());
+  for (int j = 0; j < W.rows(); ++j) {
+    double maxabs = W.row(j).cwiseAbs().maxCoeff();
+    scales[j] = maxabs > 0 ? maxabs / maxval : 1.0;
+    for (int c = 0; c < W.cols(); ++c) {
+      values(j, c) = (int16_t)round(W(j, c) / scales[j]);
+    }
+  }
+}
+
+RowMatrixXd QuantizedRowMatrix::dequantize() const
+{
+  RowMatrixXd W(rows(), cols());
+  for (int j = 0; j < rows(); ++j) {
+    W.row(j) = values.row(j).cast<double>() * scales[j];
+  }
+  return W;
+}
+
+namespace {
+  template <typename MatrixType>
+  Eigen::MatrixXd predictIncrements(const BinaryFeatures &features, const MatrixType &W)
+  {
+    const int nsamples = features.rows();
+    Eigen::MatrixXd increments(nsamples, W.cols());
+
+    #pragma omp parallel
+    {
+      vector<uint16_t> leaves(features.ntrees);
+      Eigen::VectorXd inc(W.cols());
+      #pragma omp for
+      for (int i = 0; i < nsamples; ++i) {
+        for (int k = 0; k < features.ntrees; ++k) leaves[k] = features.leaves(i, k);
+        inc.setZero();
+        GlobalRegression::accumulate(W, leaves.data(), features.ntrees, features.nleaves, inc.data());
+        increments.row(i) = inc;
+      }
+    }
+    return increments;
+  }
+}
+
+Eigen::MatrixXd GlobalRegression::predict(const BinaryFeatures &features, const RowMatrixXd &W)
+{
+  return predictIncrements(features, W);
+}
+
+Eigen::MatrixXd GlobalRegression::predict(const BinaryFeatures &features, const QuantizedRowMatrix &W)
+{
+  return predictIncrements(features, W);
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "common.h"
+#include "numerical.hpp"
+
+// local binary features of a set of samples. every tree has exactly one active
+// leaf, so instead of a sparse binary vector of ntrees x nleaves entries only
+// the index of the active leaf within each tree is stored. column k holds the
+// leaves of tree k, the active feature of tree k is k * nleaves + leaf
+struct BinaryFeatures {
+  BinaryFeatures() :ntrees(0), nleaves(0){}
+  BinaryFeatures(int nsamples, int ntrees, int nleaves)
+    :ntrees(ntrees), nleaves(nleaves), leaves(nsamples, ntrees){}
+
+  int rows() const { return leaves.rows(); }
+  int dims() const { return ntrees * nleaves; }
+
+  int ntrees, nleaves;
+  Eigen::Matrix<uint16_t, Eigen::Dynamic, Eigen::Dynamic> leaves;  // nsamples x ntrees
+};
+
+// global regression matrix, one row of shape increments per leaf so that the
+// rows of the active leaves are contiguous
+typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMatrixXd;
+
+// W with every row quantized to int16 with its own scale. a row holds the
+// increments of one leaf, so the scale adapts to the range of each leaf
+struct QuantizedRowMatrix {
+  void quantize(const RowMatrixXd &W);
+  RowMatrixXd dequantize() const;
+
+  int rows() const { return values.rows(); }
+  int cols() const { return values.cols(); }
+
+  Eigen::Matrix<int16_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> values;
+  Eigen::VectorXf scales;
+};
+
+namespace GlobalRegression {
+  // L2-regularized L2-loss support vector regression from binary features to
+  // the targets, solved in the dual by liblinear for every output coordinate in
+  // parallel. the leaf indicators are passed to liblinear as sparse feature
+  // nodes shared by all outputs. every output is shuffled from its own seed
+  // derived from seed, so W does not depend on the threads.
+  // returns false if liblinear rejects the parameters
+  bool trainSVR(const BinaryFeatures &features, const Eigen::MatrixXd &targets, double C, double eps,
+                unsigned int seed, RowMatrixXd &W);
+
+  // ridge regression from binary features to the targets, minimizes
+  // |targets - Phi * W|^2 + lambda * |W|^2 by block coordinate descent, the
+  // leaves of one tree cover disjoint sets of samples and are updated at once.
+  // needs no memory besides W and the residuals
+  RowMatrixXd trainRidge(const BinaryFeatures &features, const Eigen::MatrixXd &targets, double lambda, int iterations);
+
+  // predicted increments of all samples, nsamples x W.cols()
+  Eigen::MatrixXd predict(const BinaryFeatures &features, const RowMatrixXd &W);
+  Eigen::MatrixXd predict(const BinaryFeatures &features, const QuantizedRowMatrix &W);
+
+  // adds the rows of W of the active leaves of one sample to out, leaves[k] is
+  // the active leaf of tree k
+  inline void accumulate(const RowMatrixXd &W, const uint16_t *leaves, int ntrees, int nleaves, double *out) {
+    const int cols = W.cols();
+    for (int k = 0; k < ntrees; ++k) {
+      const double *row = W.data() + (size_t)(k * nleaves + leaves[k]) * cols;
+      for (int c = 0; c < cols; ++c) out[c] += row[c];
+    }
+  }
+
+  // rows given as a raw array, e.g. W before quantization in a mapped model file
+  inline void accumulate(const float *W, int cols, const uint16_t *leaves, int ntrees, int nleaves, double *out) {
+    for (int k = 0; k < ntrees; ++k) {
+      const float *row = W + (size_t)(k * nleaves + leaves[k]) * cols;
+      for (int c = 0; c < cols; ++c) out[c] += row[c];
+    }
+  }
+
+  // quantized rows given as raw arrays, e.g. W of a stage in a mapped model file
+  inline void accumulate(const int16_t *values, const float *scales, int cols,
+                         const uint16_t *leaves, int ntrees, int nleaves, double *out) {
+    for (int k = 0; k < ntrees; ++k) {
+      int j = k * nleaves + leaves[k];
+      const int16_t *row = values + (size_t)j * cols;
+      const float scale = scales[j];
+      for (int c = 0; c < cols; ++c) out[c] += scale * row[c];
+    }
+  }
+
+  inline void accumulate(const QuantizedRowMatrix &W, const uint16_t *leaves, int ntrees, int nleaves, double *out) {
+    accumulate(W.values.data(), W.scales.data(), W.cols(), leaves, ntrees, nleaves, out);
+  }
+}
@@ -1,11 +1,16 @@
 #include "common.h"
 #include "LBFModel.h"
 
+#include <omp.h>
+
 void printHelp() {
   cout << "usage: " << endl;
   cout << "train model: FaceAlignment3kFPS -train [training setting file] -output [model file]" << endl;
+  cout << "resume training: FaceAlignment3kFPS -train [training setting file] -output [model file] -resume" << endl;
   cout << "single test: FaceAlignment3kFPS -test [image file] -model [model file]" << endl;
   cout << "batch tests: FaceAlignment3kFPS -batch_test [test setting file] -model [model file]" << endl;
+  cout << "convert points: FaceAlignment3kFPS -convert_points [setting file] -output [points file]" << endl;
+  cout << "options: -threads [number of threads, all cores by default]" << endl;
 }
 
 int main(int argc, char **argv) {
@@ -17,18 +22,23 @@ int main(int argc, char **argv) {
     for (int i = 1; i < argc; ++i) {
       string arg = argv[i];
       if (arg[0] == '-') {
-        args[arg] = argv[i + 1];
+        // options like -resume have no value
+        bool hasValue = i + 1 < argc && argv[i + 1][0] != '-';
+        args[arg] = hasValue ? argv[i + 1] : "";
       }
     }
     for (auto p : args) {
       cout << p.first << ": " << p.second << endl;
     }
 
+    if (args.find("-threads") != args.end()) {
+      omp_set_num_threads(stoi(args["-threads"]));
+    }
+
     if (args.find("-train") != args.end()) {
       // train a model
       LBFModel model;
-      model.train(args["-train"]);
-      model.save(args["-output"]);
+      model.train(args["-train"], args["-output"], args.find("-resume") != args.end());
     }    
     else if (args.find("-test") != args.end()) {
       // single test 
@@ -40,6 +50,11 @@ int main(int argc, char **argv) {
       LBFModel model(args["-model"]);
       model.batch_test(args["-batch_test"]);
     }
+    else if (args.find("-convert_points") != args.end()) {
+      // one points file for the .pts files of a data set
+      LBFModel model;
+      model.convertPoints(args["-convert_points"], args["-output"]);
+    }
   }  
   return 0;
 }
\ No newline at end of file
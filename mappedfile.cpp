@@ -0,0 +1,56 @@
+#include "mappedfile.h"
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool MappedFile::open(const string &filename)
+{
+  close();
+#ifdef _WIN32
+  ifstream f(filename, ios::binary | ios::ate);
+  if (!f.good()) return false;
+  length = f.tellg();
+  if (length == 0) return false;
+  base = static_cast<char *>(_aligned_malloc(length, 64));
+  f.seekg(0);
+  f.read(base, length);
+  if (!f.good()) { close(); return false; }
+#else
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    ::close(fd);
+    return false;
+  }
+  length = st.st_size;
+  // a shared read-only mapping, processes using the same file share its pages
+  void *p = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED) {
+    length = 0;
+    return false;
+  }
+  base = static_cast<char *>(p);
+#endif
+  return true;
+}
+
+void MappedFile::close()
+{
+  if (base != nullptr) {
+#ifdef _WIN32
+    _aligned_free(base);
+#else
+    munmap(base, length);
+#endif
+  }
+  base = nullptr;
+  length = 0;
+}
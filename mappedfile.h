@@ -0,0 +1,26 @@
+#pragma once
+
+#include "common.h"
+
+// a read-only memory mapping of a whole file, the data starts at a page
+// boundary. without mmap the file is read into a 64 byte aligned buffer
+class MappedFile
+{
+public:
+  MappedFile() :base(nullptr), length(0){}
+  ~MappedFile() { close(); }
+
+  bool open(const string &filename);
+  void close();
+
+  bool isOpen() const { return base != nullptr; }
+  const char *data() const { return base; }
+  size_t size() const { return length; }
+
+private:
+  MappedFile(const MappedFile &);
+  MappedFile &operator=(const MappedFile &);
+
+  char *base;
+  size_t length;
+};
@@ -0,0 +1,199 @@
+#include "modelfile.h"
+
+#include <cstring>
+
+#include <boost/filesystem.hpp>
+
+namespace {
+  const char magic[8] = { 'L', 'B', 'F', 'M', 'O', 'D', 'E', 'L' };
+
+  // offset of the end of the last block of a stage
+  uint64_t stageEnd(const ModelFile::StageEntry &e, const ModelFile::StageSizes &sizes) {
+    if (e.reference != 0) return e.reference + sizes.weights * sizeof(float);
+    return e.weights + sizes.weights * sizeof(int16_t);
+  }
+
+  // whether the fields of a header are in range. the counts of pixels and of
+  // leaves are used as int when a model is fitted, which also keeps the sizes
+  // of the blocks from overflowing
+  bool validHeader(const ModelFile::Header &h) {
+    if (h.windowSize <= 0 || h.T <= 0 || h.N <= 0 || h.D <= 0 || h.D > 15 || h.Npixels <= 0 || h.Nfp <= 0
+        || h.nstages < 0 || h.nstages > h.T) return false;
+    const int64_t maxint = numeric_limits<int>::max();
+    return (int64_t)h.Nfp * h.Npixels <= maxint && (int64_t)h.Nfp * h.N <= maxint
+      && (int64_t)h.Nfp * h.N * (1 << h.D) <= maxint;
+  }
+
+  // whether a block of count elements of the given size at offset is aligned
+  // and lies inside a file of length bytes
+  bool blockInside(uint64_t offset, size_t count, size_t size, size_t length) {
+    return offset != 0 && offset % ModelFile::alignment == 0 && offset <= length
+      && count <= (length - offset) / size;
+  }
+}
+
+bool ModelFile::Writer::open(const string &filename, const Header &h, const Eigen::VectorXd &meanshape)
+{
+  assert(meanshape.rows() == h.Nfp * 2);
+  f.open(filename, ios::in | ios::out | ios::binary | ios::trunc);
+  if (!f.good()) return false;
+
+  header = h;
+  memcpy(header.magic, magic, sizeof(magic));
+  header.version = currentVersion;
+  header.byteOrder = byteOrderMark;
+  header.nstages = 0;
+  table.assign(header.T, StageEntry());
+  memset(table.data(), 0, table.size() * sizeof(StageEntry));
+
+  f.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+  f.write(reinterpret_cast<const char *>(table.data()), table.size() * sizeof(StageEntry));
+  uint64_t offset;
+  writeBlock(meanshape.data(), meanshape.rows() * sizeof(double), offset);
+  f.flush();
+  return f.good();
+}
+
+bool ModelFile::Writer::resume(const string &filename, const Header &h, const Eigen::VectorXd &meanshape, int nstages)
+{
+  f.open(filename, ios::in | ios::out | ios::binary);
+  if (!f.good()) return false;
+
+  f.read(reinterpret_cast<char *>(&header), sizeof(Header));
+  if (!f.good() || memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != currentVersion
+      || header.byteOrder != byteOrderMark || !validHeader(header) || nstages > header.nstages) {
+    f.close();
+    return false;
+  }
+  table.resize(header.T);
+  f.read(reinterpret_cast<char *>(table.data()), table.size() * sizeof(StageEntry));
+
+  // stages of a different size must not be appended under the header of the file
+  Eigen::VectorXd fileMeanshape(header.Nfp * 2);
+  f.seekg(align(sizeof(Header) + header.T * sizeof(StageEntry)));
+  f.read(reinterpret_cast<char *>(fileMeanshape.data()), fileMeanshape.rows() * sizeof(double));
+  if (!f.good() || header.windowSize != h.windowSize || header.T != h.T || header.N != h.N || header.D != h.D
+      || header.Npixels != h.Npixels || header.Nfp != h.Nfp || fileMeanshape != meanshape) {
+    cerr << "model file " << filename << " was written with different parameters" << endl;
+    f.close();
+    return false;
+  }
+
+  // the file ends after the last kept stage, or after the meanshape
+  StageSizes sizes(header);
+  uint64_t end = align(sizeof(Header) + header.T * sizeof(StageEntry)) + header.Nfp * 2 * sizeof(double);
+  if (nstages > 0) end = stageEnd(table[nstages - 1], sizes);
+  memset(table.data() + nstages, 0, (header.T - nstages) * sizeof(StageEntry));
+  header.nstages = nstages;
+
+  f.seekp(0);
+  f.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+  f.write(reinterpret_cast<const char *>(table.data()), table.size() * sizeof(StageEntry));
+  f.close();
+  boost::filesystem::resize_file(filename, end);
+
+  f.open(filename, ios::in | ios::out | ios::binary);
+  return f.good();
+}
+
+void ModelFile::Writer::writeBlock(const void *data, size_t bytes, uint64_t &offset)
+{
+  f.seekp(0, ios::end);
+  size_t end = f.tellp();
+  offset = align(end);
+  static const char zeros[alignment] = {};
+  f.write(zeros, offset - end);
+  f.write(reinterpret_cast<const char *>(data), bytes);
+}
+
+bool ModelFile::Writer::appendStage(const float *ox, const float *oy, const RegressionTreeFlatNode *nodes,
+                                    const float *scales, const int16_t *weights, const float *reference)
+{
+  assert(header.nstages < header.T);
+  StageSizes sizes(header);
+  StageEntry &entry = table[header.nstages];
+  writeBlock(ox, sizes.offsets * sizeof(float), entry.ox);
+  writeBlock(oy, sizes.offsets * sizeof(float), entry.oy);
+  writeBlock(nodes, sizes.nodes * sizeof(RegressionTreeFlatNode), entry.nodes);
+  writeBlock(scales, sizes.rows * sizeof(float), entry.scales);
+  writeBlock(weights, sizes.weights * sizeof(int16_t), entry.weights);
+  entry.reference = 0;
+  if (reference != nullptr) writeBlock(reference, sizes.weights * sizeof(float), entry.reference);
+  f.flush();
+  if (!f.good()) return false;
+
+  // the stage only becomes part of the model once its data is in the file
+  f.seekp(sizeof(Header) + header.nstages * sizeof(StageEntry));
+  f.write(reinterpret_cast<const char *>(&entry), sizeof(StageEntry));
+  f.flush();
+  ++header.nstages;
+  f.seekp(0);
+  f.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+  f.flush();
+  return f.good();
+}
+
+void ModelFile::Writer::close()
+{
+  f.close();
+}
+
+bool ModelFile::Reader::open(const string &filename)
+{
+  close();
+  if (!file.open(filename)) return false;
+
+  const char *base = file.data();
+  const size_t length = file.size();
+  if (length < sizeof(Header) || memcmp(header().magic, magic, sizeof(magic)) != 0) {
+    cerr << "not a model file: " << filename << endl;
+    close();
+    return false;
+  }
+  const Header &h = header();
+  if (h.byteOrder != byteOrderMark || h.version != currentVersion) {
+    cerr << "unsupported model file version or byte order: " << filename << endl;
+    close();
+    return false;
+  }
+
+  // the header, the stage table and every block must be valid before
+  // anything is read through the mapping
+  size_t meanshapeOffset = align(sizeof(Header) + (size_t)h.T * sizeof(StageEntry));
+  if (!validHeader(h) || !blockInside(meanshapeOffset, h.Nfp * 2, sizeof(double), length)) {
+    cerr << "corrupted model file: " << filename << endl;
+    close();
+    return false;
+  }
+  StageSizes sizes(h);
+  const StageEntry *table = reinterpret_cast<const StageEntry *>(base + sizeof(Header));
+  meanshapePtr = reinterpret_cast<const double *>(base + meanshapeOffset);
+
+  views.resize(h.nstages);
+  for (int t = 0; t < h.nstages; ++t) {
+    const StageEntry &e = table[t];
+    if (!blockInside(e.ox, sizes.offsets, sizeof(float), length)
+        || !blockInside(e.oy, sizes.offsets, sizeof(float), length)
+        || !blockInside(e.nodes, sizes.nodes, sizeof(RegressionTreeFlatNode), length)
+        || !blockInside(e.scales, sizes.rows, sizeof(float), length)
+        || !blockInside(e.weights, sizes.weights, sizeof(int16_t), length)
+        || (e.reference != 0 && !blockInside(e.reference, sizes.weights, sizeof(float), length))) {
+      cerr << "truncated model file: " << filename << endl;
+      close();
+      return false;
+    }
+    views[t].ox = reinterpret_cast<const float *>(base + e.ox);
+    views[t].oy = reinterpret_cast<const float *>(base + e.oy);
+    views[t].nodes = reinterpret_cast<const RegressionTreeFlatNode *>(base + e.nodes);
+    views[t].scales = reinterpret_cast<const float *>(base + e.scales);
+    views[t].weights = reinterpret_cast<const int16_t *>(base + e.weights);
+    views[t].reference = e.reference != 0 ? reinterpret_cast<const float *>(base + e.reference) : nullptr;
+  }
+  return true;
+}
+
+void ModelFile::Reader::close()
+{
+  file.close();
+  views.clear();
+}
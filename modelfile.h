@@ -0,0 +1,110 @@
+#pragma once
+
+#include "common.h"
+#include "regressiontree.hpp"
+#include "mappedfile.h"
+
+// Binary model file. All values are little-endian and every block starts at a
+// multiple of 64 bytes, so a loaded model is used in place from a read-only
+// memory mapping of the file:
+//
+//   Header
+//   StageEntry[T]                                stage table, zero for stages not written yet
+//   double[Lfp]                                  meanshape
+//   for every stage:
+//     float[Nfp * Npixels]                       x offsets of the sampled pixels
+//     float[Nfp * Npixels]                       y offsets of the sampled pixels
+//     RegressionTreeFlatNode[Nfp * N * (2^D-1)]  split nodes of all trees
+//     float[Nfp * N * 2^D]                       scales of the rows of W
+//     int16_t[Nfp * N * 2^D * Lfp]               rows of W
+//     float[Nfp * N * 2^D * Lfp]                 rows of W before quantization, optional
+namespace ModelFile {
+  const uint32_t currentVersion = 1;
+  const uint32_t byteOrderMark = 0x01020304;
+  const size_t alignment = 64;
+
+  inline size_t align(size_t n) {
+    return (n + alignment - 1) / alignment * alignment;
+  }
+
+  struct Header {
+    char magic[8];        // "LBFMODEL"
+    uint32_t version;
+    uint32_t byteOrder;   // byteOrderMark as written by the host
+    int32_t windowSize;
+    int32_t T;            // number of stages of the complete model
+    int32_t N;            // number of trees per landmark
+    int32_t D;            // depth of the trees
+    int32_t Npixels;      // number of sampled pixels per landmark
+    int32_t Nfp;          // number of landmarks
+    int32_t nstages;      // number of stages in the file, less than T for a partial model
+    int32_t reserved[5];
+  };
+  static_assert(sizeof(Header) == 64, "ModelFile::Header must be 64 bytes");
+
+  struct StageEntry {
+    uint64_t ox, oy, nodes, scales, weights;  // file offsets of the blocks
+    uint64_t reference;                       // offset of the rows of W before quantization, 0 if not stored
+    uint64_t reserved[2];
+  };
+  static_assert(sizeof(StageEntry) == 64, "ModelFile::StageEntry must be 64 bytes");
+
+  // one stage of a model, pointing into the mapped file
+  struct StageView {
+    const float *ox, *oy;
+    const RegressionTreeFlatNode *nodes;
+    const float *scales;
+    const int16_t *weights;
+    const float *reference;  // nullptr if not stored
+  };
+
+  // sizes of the blocks of one stage, in elements
+  struct StageSizes {
+    StageSizes(const Header &h)
+      :offsets((size_t)h.Nfp * h.Npixels),
+       nodes((size_t)h.Nfp * h.N * ((1 << h.D) - 1)),
+       rows((size_t)h.Nfp * h.N * (1 << h.D)),
+       weights(rows * h.Nfp * 2){}
+    size_t offsets, nodes, rows, weights;
+  };
+
+  // writes the header, the stage table and the meanshape on open, stages are
+  // appended one at a time and the file is a valid model with all stages
+  // appended so far after every call
+  class Writer {
+  public:
+    bool open(const string &filename, const Header &header, const Eigen::VectorXd &meanshape);
+    // reopens a partial model file to append stages after its first nstages,
+    // stages beyond those are discarded. the file must have been written with
+    // the same header, apart from the number of stages, and meanshape
+    bool resume(const string &filename, const Header &header, const Eigen::VectorXd &meanshape, int nstages);
+    // reference are the rows of W before quantization, used to measure the
+    // error of the quantization, the block is left out for nullptr
+    bool appendStage(const float *ox, const float *oy, const RegressionTreeFlatNode *nodes,
+                     const float *scales, const int16_t *weights, const float *reference = nullptr);
+    void close();
+
+  private:
+    void writeBlock(const void *data, size_t bytes, uint64_t &offset);
+
+    fstream f;
+    Header header;
+    vector<StageEntry> table;
+  };
+
+  // a read-only memory mapping of a model file
+  class Reader {
+  public:
+    bool open(const string &filename);
+    void close();
+
+    const Header &header() const { return *reinterpret_cast<const Header *>(file.data()); }
+    const double *meanshape() const { return meanshapePtr; }
+    const vector<StageView> &stages() const { return views; }
+
+  private:
+    MappedFile file;
+    const double *meanshapePtr;
+    vector<StageView> views;
+  };
+}
@@ -0,0 +1,111 @@
+#include "pixelsampler.h"
+
+#ifdef PIXELSAMPLER_AVX2
+#include <immintrin.h>
+#endif
+
+void PixelSampler::resize(int nlandmarks, int npixels)
+{
+  this->npixels = npixels;
+  ox.assign(nlandmarks * npixels, 0);
+  oy.assign(nlandmarks * npixels, 0);
+}
+
+void PixelSampler::setLocations(int landmark, const Eigen::MatrixXd &locations)
+{
+  assert(locations.rows() == npixels && landmark < numLandmarks());
+  for (int j = 0; j < npixels; ++j) {
+    ox[landmark * npixels + j] = locations(j, 0);
+    oy[landmark * npixels + j] = locations(j, 1);
+  }
+}
+
+void PixelSampler::sampleLandmark(const cv::Mat &img, const Eigen::VectorXd &shape, const Eigen::Matrix2d &invM,
+                                  int landmark, uint8_t *out) const
+{
+  const float m[4] = { (float)invM(0, 0), (float)invM(0, 1), (float)invM(1, 0), (float)invM(1, 1) };
+  sample(img, &ox[landmark * npixels], &oy[landmark * npixels], npixels,
+         shape[landmark * 2], shape[landmark * 2 + 1], m, out);
+}
+
+void PixelSampler::sample(const cv::Mat &img, const Eigen::VectorXd &shape, const Eigen::Matrix2d &invM, uint8_t *out) const
+{
+  for (int l = 0; l < numLandmarks(); ++l) {
+    sampleLandmark(img, shape, invM, l, out + l * npixels);
+  }
+}
+
+void PixelSampler::sample(const cv::Mat &img, const float *ox, const float *oy, int n,
+                          float px, float py, const float m[4], uint8_t *out)
+{
+  assert(img.type() == CV_8UC1);
+#ifdef PIXELSAMPLER_AVX2
+  // the gathers read 4 bytes per pixel, which needs rows of at least 4 pixels
+  if (img.cols >= 4 && hasAVX2()) {
+    sampleAVX2(img.data, img.step, img.cols, img.rows, ox, oy, n, px, py, m, out);
+    return;
+  }
+#endif
+  sampleScalar(img.data, img.step, img.cols, img.rows, ox, oy, n, px, py, m, out);
+}
+
+void PixelSampler::sampleScalar(const uint8_t *data, int step, int cols, int rows,
+                                const float *ox, const float *oy, int n,
+                                float px, float py, const float m[4], uint8_t *out)
+{
+  const float maxx = cols - 1, maxy = rows - 1;
+  for (int j = 0; j < n; ++j) {
+    float x = px + (m[0] * ox[j] + m[1] * oy[j]);
+    float y = py + (m[2] * ox[j] + m[3] * oy[j]);
+    x = std::min(std::max(x, 0.0f), maxx);
+    y = std::min(std::max(y, 0.0f), maxy);
+    int xi = (int)floor(x + 0.5f), yi = (int)floor(y + 0.5f);
+    out[j] = data[yi * step + xi];
+  }
+}
+
+#ifdef PIXELSAMPLER_AVX2
+bool PixelSampler::hasAVX2()
+{
+  static const bool supported = __builtin_cpu_supports("avx2");
+  return supported;
+}
+
+__attribute__((target("avx2")))
+void PixelSampler::sampleAVX2(const uint8_t *data, int step, int cols, int rows,
+                              const float *ox, const float *oy, int n,
+                              float px, float py, const float m[4], uint8_t *out)
+{
+  const __m256 m0 = _mm256_set1_ps(m[0]), m1 = _mm256_set1_ps(m[1]);
+  const __m256 m2 = _mm256_set1_ps(m[2]), m3 = _mm256_set1_ps(m[3]);
+  const __m256 vpx = _mm256_set1_ps(px), vpy = _mm256_set1_ps(py);
+  const __m256 zero = _mm256_setzero_ps(), half = _mm256_set1_ps(0.5f);
+  const __m256 maxx = _mm256_set1_ps(cols - 1), maxy = _mm256_set1_ps(rows - 1);
+  const __m256i lastx = _mm256_set1_epi32(cols - 4), vstep = _mm256_set1_epi32(step);
+  const __m256i mask = _mm256_set1_epi32(0xff);
+
+  int j = 0;
+  for (; j + 8 <= n; j += 8) {
+    __m256 vox = _mm256_loadu_ps(ox + j), voy = _mm256_loadu_ps(oy + j);
+    __m256 x = _mm256_add_ps(vpx, _mm256_add_ps(_mm256_mul_ps(m0, vox), _mm256_mul_ps(m1, voy)));
+    __m256 y = _mm256_add_ps(vpy, _mm256_add_ps(_mm256_mul_ps(m2, vox), _mm256_mul_ps(m3, voy)));
+    x = _mm256_min_ps(_mm256_max_ps(x, zero), maxx);
+    y = _mm256_min_ps(_mm256_max_ps(y, zero), maxy);
+    __m256i xi = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_add_ps(x, half)));
+    __m256i yi = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_add_ps(y, half)));
+
+    // gather 4 bytes starting at most 3 pixels before the wanted one so the
+    // load never runs past the end of the row, then shift the wanted byte down
+    __m256i xl = _mm256_min_epi32(xi, lastx);
+    __m256i shift = _mm256_slli_epi32(_mm256_sub_epi32(xi, xl), 3);
+    __m256i idx = _mm256_add_epi32(_mm256_mullo_epi32(yi, vstep), xl);
+    __m256i v = _mm256_i32gather_epi32(reinterpret_cast<const int *>(data), idx, 1);
+    v = _mm256_and_si256(_mm256_srlv_epi32(v, shift), mask);
+
+    // pack the 8 intensities into 8 bytes
+    __m128i v16 = _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(out + j), _mm_packus_epi16(v16, v16));
+  }
+  sampleScalar(data, step, cols, rows, ox + j, oy + j, n - j, px, py, m, out + j);
+}
+#endif
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "common.h"
+#include "numerical.hpp"
+
+#include "opencv2/core/core.hpp"
+
+// the AVX2 sampler is compiled for AVX2 on its own, the rest of the program
+// keeps the generic flags, and it is only used if the processor supports it
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__)) && !defined(NO_AVX2)
+#define PIXELSAMPLER_AVX2
+#endif
+
+// Shape-indexed pixel sampling: every landmark owns a set of offsets defined
+// in the mean shape space. For a shape in an image, the offsets are mapped into
+// the image with the similarity transform from the mean shape to the shape,
+// added to the landmark position, clamped to the image and the grayscale
+// intensities at the nearest pixels are read.
+class PixelSampler
+{
+public:
+  PixelSampler() :npixels(0){}
+  PixelSampler(int nlandmarks, int npixels) { resize(nlandmarks, npixels); }
+
+  void resize(int nlandmarks, int npixels);
+  // locations is a npixels x 2 matrix of offsets w.r.t. the landmark in mean shape
+  void setLocations(int landmark, const Eigen::MatrixXd &locations);
+
+  int numLandmarks() const { return npixels > 0 ? ox.size() / npixels : 0; }
+  int numPixels() const { return npixels; }
+
+  // intensities of the locations of one landmark, out has numPixels() entries
+  void sampleLandmark(const cv::Mat &img, const Eigen::VectorXd &shape, const Eigen::Matrix2d &invM,
+                      int landmark, uint8_t *out) const;
+  // intensities of all landmarks, out has numLandmarks() x numPixels() entries
+  // in landmark major order
+  void sample(const cv::Mat &img, const Eigen::VectorXd &shape, const Eigen::Matrix2d &invM, uint8_t *out) const;
+
+  // intensities at n offsets around (px, py) mapped with the 2x2 matrix m, uses
+  // the vectorized sampler when the processor supports it
+  static void sample(const cv::Mat &img, const float *ox, const float *oy, int n,
+                     float px, float py, const float m[4], uint8_t *out);
+
+  // reference implementation, used for the tails of the vectorized loops and
+  // when AVX2 is not available
+  static void sampleScalar(const uint8_t *data, int step, int cols, int rows,
+                           const float *ox, const float *oy, int n,
+                           float px, float py, const float m[4], uint8_t *out);
+#ifdef PIXELSAMPLER_AVX2
+  // whether the processor supports AVX2, checked once
+  static bool hasAVX2();
+  static void sampleAVX2(const uint8_t *data, int step, int cols, int rows,
+                         const float *ox, const float *oy, int n,
+                         float px, float py, const float m[4], uint8_t *out);
+#endif
+
+private:
+  int npixels;
+  vector<float> ox, oy;  // offsets of all landmarks, landmark major
+};
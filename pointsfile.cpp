@@ -0,0 +1,144 @@
+#include "pointsfile.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace {
+  const char magic[8] = { 'L', 'B', 'F', 'P', 'O', 'I', 'N', 'T' };
+  const uint32_t byteOrderMark = 0x01020304;
+
+  inline bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+  inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+  inline const char *skipSpace(const char *p, const char *end) {
+    while (p < end && isSpace(*p)) ++p;
+    return p;
+  }
+
+  // parses a decimal number with an optional fraction and exponent, returns
+  // nullptr if p does not start with a number
+  const char *parseNumber(const char *p, const char *end, double &value) {
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+
+    // up to 18 significant digits are kept in the mantissa
+    const uint64_t maxMantissa = 100000000000000000ULL;
+    uint64_t mantissa = 0;
+    int exponent = 0, digits = 0;
+    for (; p < end && isDigit(*p); ++p, ++digits) {
+      if (mantissa < maxMantissa) mantissa = mantissa * 10 + (*p - '0');
+      else ++exponent;
+    }
+    if (p < end && *p == '.') {
+      for (++p; p < end && isDigit(*p); ++p, ++digits) {
+        if (mantissa < maxMantissa) {
+          mantissa = mantissa * 10 + (*p - '0');
+          --exponent;
+        }
+      }
+    }
+    if (digits == 0) return nullptr;
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+      ++p;
+      bool negativeExponent = false;
+      if (p < end && (*p == '-' || *p == '+')) negativeExponent = *p++ == '-';
+      if (p == end || !isDigit(*p)) return nullptr;
+      int e = 0;
+      for (; p < end && isDigit(*p); ++p) e = std::min(e * 10 + (*p - '0'), 1000);
+      exponent += negativeExponent ? -e : e;
+    }
+
+    // dividing by an exact power of ten keeps fractions like 0.1 exact
+    double m = (double)mantissa;
+    value = exponent < 0 ? m / pow(10.0, -exponent) : m * pow(10.0, exponent);
+    if (negative) value = -value;
+    return p;
+  }
+}
+
+bool PointsFile::parsePts(const char *begin, const char *end, Eigen::VectorXd &pts)
+{
+  // the header ends at the opening brace and holds the number of points
+  const char *brace = std::find(begin, end, '{');
+  const char key[] = "n_points";
+  const char *p = std::search(begin, brace, key, key + sizeof(key) - 1);
+  if (brace == end || p == brace) return false;
+  p = skipSpace(p + sizeof(key) - 1, brace);
+  if (p == brace || *p != ':') return false;
+  p = skipSpace(p + 1, brace);
+  int npoints = 0;
+  for (; p < brace && isDigit(*p); ++p) npoints = npoints * 10 + (*p - '0');
+  if (npoints <= 0 || npoints > 100000) return false;
+
+  pts.resize(npoints * 2);
+  p = brace + 1;
+  for (int i = 0; i < npoints * 2; ++i) {
+    p = parseNumber(skipSpace(p, end), end, pts[i]);
+    if (p == nullptr) return false;
+  }
+  p = skipSpace(p, end);
+  return p < end && *p == '}';
+}
+
+bool PointsFile::readPts(const string &filename, Eigen::VectorXd &pts)
+{
+  FILE *f = fopen(filename.c_str(), "rb");
+  if (f == nullptr) return false;
+
+  // the buffer only grows, so reading a data set allocates once per thread
+  static thread_local vector<char> buffer;
+  size_t length = 0;
+  for (;;) {
+    if (buffer.size() < length + 4096) buffer.resize(std::max(buffer.size() * 2, length + 4096));
+    size_t n = fread(buffer.data() + length, 1, buffer.size() - length, f);
+    length += n;
+    if (n == 0) break;
+  }
+  bool failed = ferror(f) != 0;
+  fclose(f);
+  return !failed && parsePts(buffer.data(), buffer.data() + length, pts);
+}
+
+bool PointsFile::write(const string &filename, const vector<Eigen::VectorXd> &points)
+{
+  Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, magic, sizeof(magic));
+  header.version = currentVersion;
+  header.byteOrder = byteOrderMark;
+  header.nimages = points.size();
+  for (auto &pts : points) header.Lfp = std::max<int>(header.Lfp, pts.rows());
+
+  ofstream f(filename, ios::binary);
+  f.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+  const vector<double> missing(header.Lfp, numeric_limits<double>::quiet_NaN());
+  for (auto &pts : points) {
+    if (pts.rows() == header.Lfp) f.write(reinterpret_cast<const char *>(pts.data()), header.Lfp * sizeof(double));
+    else f.write(reinterpret_cast<const char *>(missing.data()), header.Lfp * sizeof(double));
+  }
+  f.close();
+  return !f.fail();
+}
+
+bool PointsFile::Reader::open(const string &filename)
+{
+  close();
+  if (!file.open(filename)) return false;
+
+  if (file.size() < sizeof(Header) || memcmp(header().magic, magic, sizeof(magic)) != 0
+      || header().version != currentVersion || header().byteOrder != byteOrderMark
+      || sizeof(Header) + (size_t)header().nimages * header().Lfp * sizeof(double) > file.size()) {
+    cerr << "not a points file: " << filename << endl;
+    close();
+    return false;
+  }
+  return true;
+}
+
+const double *PointsFile::Reader::points(int i) const
+{
+  if (i < 0 || i >= header().nimages) return nullptr;
+  const double *pts = reinterpret_cast<const double *>(file.data() + sizeof(Header)) + (size_t)i * header().Lfp;
+  return std::isnan(pts[0]) ? nullptr : pts;
+}
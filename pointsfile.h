@@ -0,0 +1,56 @@
+#pragma once
+
+#include "common.h"
+#include "numerical.hpp"
+#include "mappedfile.h"
+
+// Landmark files. A .pts file is a text file of the form
+//
+//   version: 1
+//   n_points: 68
+//   {
+//   x1 y1
+//   ...
+//   }
+//
+// the points of a whole data set are also kept in one binary file, little
+// endian, indexed by the image index of the data set counting from 0:
+//
+//   Header
+//   double[nimages * Lfp]   points of every image, x1 y1 x2 y2 ..., NaN for
+//                           images without points
+namespace PointsFile {
+  const uint32_t currentVersion = 1;
+
+  struct Header {
+    char magic[8];        // "LBFPOINT"
+    uint32_t version;
+    uint32_t byteOrder;   // 0x01020304 as written by the host
+    int32_t nimages;
+    int32_t Lfp;          // number of point coordinates of an image
+    int32_t reserved[10];
+  };
+  static_assert(sizeof(Header) == 64, "PointsFile::Header must be 64 bytes");
+
+  // parses the text of a .pts file, fails on malformed or truncated files
+  bool parsePts(const char *begin, const char *end, Eigen::VectorXd &pts);
+  // reads a .pts file into a buffer kept per thread and parses it
+  bool readPts(const string &filename, Eigen::VectorXd &pts);
+
+  // writes the points of all images, empty vectors for images without points
+  bool write(const string &filename, const vector<Eigen::VectorXd> &points);
+
+  class Reader {
+  public:
+    bool open(const string &filename);
+    void close() { file.close(); }
+    bool isOpen() const { return file.isOpen(); }
+
+    const Header &header() const { return *reinterpret_cast<const Header *>(file.data()); }
+    // points of image i, nullptr if the image has none
+    const double *points(int i) const;
+
+  private:
+    MappedFile file;
+  };
+}
@@ -1,25 +1,62 @@
 #pragma once
 
+#include "common.h"
+#include "numerical.hpp"
+#include "regressiontree.hpp"
+
+#include <omp.h>
+
 template <typename TreeType>
 struct RegressionForest {
-  RegressionForest(){}
+  RegressionForest() :ntrees(0){}
 
-  void init(int N, int D, int Ndims, double threshold) {
+  void init(int N, int D, int Ndims, double threshold,
+            typename TreeType::SplitObjective objective = TreeType::VarianceReduction, int binWidth = 0) {
+    ntrees = N;
     trees.resize(N);
     for (auto &t : trees) {
-      t = TreeType(N, D, threshold);
+      t = TreeType(Ndims, D, threshold, objective, binWidth);
     }
   }
-  void train(const Eigen::MatrixXd &pixels, const Eigen::MatrixXd &deltashape);
+  template <typename PixelType>
+  void train(const PixelMatrix<PixelType> &pixels, const Eigen::MatrixXd &deltashape, unsigned int seed = 0);
 
   int ntrees;
   vector<TreeType> trees;
+
+protected:
+  template <typename PixelType>
+  void spawnTrainingTasks(const PixelMatrix<PixelType> &pixels, const Eigen::MatrixXd &deltashape, unsigned int seed);
 };
 
 template <typename TreeType>
-void RegressionForest<TreeType>::train(const Eigen::MatrixXd &pixels, const Eigen::MatrixXd &deltashape)
+template <typename PixelType>
+void RegressionForest<TreeType>::train(const PixelMatrix<PixelType> &pixels, const Eigen::MatrixXd &deltashape, unsigned int seed)
+{
+  // when called from a task of an enclosing parallel region, the tree tasks
+  // join that region so idle threads there can pick them up
+  if (omp_in_parallel()) {
+    spawnTrainingTasks(pixels, deltashape, seed);
+  }
+  else {
+    #pragma omp parallel
+    #pragma omp single
+    spawnTrainingTasks(pixels, deltashape, seed);
+  }
+}
+
+template <typename TreeType>
+template <typename PixelType>
+void RegressionForest<TreeType>::spawnTrainingTasks(const PixelMatrix<PixelType> &pixels, const Eigen::MatrixXd &deltashape, unsigned int seed)
 {
+  // trees vary a lot in cost, one task per tree keeps all threads busy
   for (int i = 0; i < ntrees; ++i) {
-    trees[i].train(pixels, deltashape);
+    std::seed_seq seq{ seed, (unsigned int)i };
+    unsigned int treeSeed;
+    seq.generate(&treeSeed, &treeSeed + 1);
+
+    #pragma omp task shared(pixels, deltashape) firstprivate(i, treeSeed)
+    trees[i].train(pixels, deltashape, treeSeed);
   }
+  #pragma omp taskwait
 }
@@ -4,7 +4,6 @@
 #include "numerical.hpp"
 
 struct RegressionTreeNode {
-  vector<int> samples;
   int m, n;
   double splitVal;
   Eigen::Vector2d output;
@@ -15,6 +14,109 @@ struct RegressionTreeNode {
   shared_ptr<RegressionTreeNode> lchild, rchild;
 };
 
+// packed split node of the compiled tree, a sample goes to the right child if
+// pixel[m] - pixel[n] >= threshold
+struct RegressionTreeFlatNode {
+  int16_t m, n;
+  float threshold;
+};
+static_assert(sizeof(RegressionTreeFlatNode) == 8, "RegressionTreeFlatNode must be packed into 8 bytes");
+
+// leaf slot reached by a sample in a compiled tree of the given depth, nodes
+// holds the 2^depth - 1 split nodes in breadth first order
+template <typename SampleType>
+inline int flatTreeLeafIndex(const RegressionTreeFlatNode *nodes, int depth, const SampleType &sample) {
+  int idx = 0;
+  for (int d = 0; d < depth; ++d) {
+    const RegressionTreeFlatNode &node = nodes[idx];
+    idx = idx * 2 + 1 + (sample[node.m] - sample[node.n] >= node.threshold);
+  }
+  return idx - ((1 << depth) - 1);
+}
+
+// training features, one row per sample and one column per sampled pixel
+template <typename PixelType>
+using PixelMatrix = Eigen::Matrix<PixelType, Eigen::Dynamic, Eigen::Dynamic>;
+
+// histograms of the 2-D targets over the binned pixel differences of a set of
+// candidate features, pixel differences of 8-bit intensities lie in [-255, 255]
+struct RegressionTreeHistogram {
+  struct Bin {
+    int count;
+    double sum[2];
+  };
+
+  RegressionTreeHistogram() :nbins(0), binWidth(1){}
+
+  static const int maxDiff = 255;
+
+  int bin(double diff) const {
+    int b = (int)floor((diff + maxDiff) / binWidth);
+    return std::min(std::max(b, 0), nbins - 1);
+  }
+  // samples with a difference below the threshold fall into bins [0, b]
+  double threshold(int b) const {
+    return (b + 1) * binWidth - maxDiff;
+  }
+
+  template <typename PixelType>
+  void build(const int *samples, int nsamples, const vector<pair<int, int>> &dims, int width,
+             const PixelMatrix<PixelType> &pixels, const Eigen::MatrixXd &ds) {
+    binWidth = width;
+    nbins = (2 * maxDiff + binWidth) / binWidth;
+    bins.assign(dims.size() * nbins, Bin{ 0, { 0, 0 } });
+    for (int f = 0; f < dims.size(); ++f) {
+      Bin *hist = &bins[f * nbins];
+      int m = dims[f].first, n = dims[f].second;
+      for (int i = 0; i < nsamples; ++i) {
+        int s = samples[i];
+        Bin &b = hist[bin(pixels(s, m) - pixels(s, n))];
+        ++b.count;
+        b.sum[0] += ds(s, 0);
+        b.sum[1] += ds(s, 1);
+      }
+    }
+  }
+
+  // turns the histograms of a node into those of the sibling of other
+  void subtract(const RegressionTreeHistogram &other) {
+    assert(bins.size() == other.bins.size());
+    for (int i = 0; i < bins.size(); ++i) {
+      bins[i].count -= other.bins[i].count;
+      bins[i].sum[0] -= other.bins[i].sum[0];
+      bins[i].sum[1] -= other.bins[i].sum[1];
+    }
+  }
+
+  // best threshold of feature f by a sweep over its bins, the error is the
+  // sum of squared residuals of both sides given the node totals
+  pair<double, double> findBestSplit(int f, int nsamples, const Eigen::Vector2d &sum, double sumSquares) const {
+    const Bin *hist = &bins[f * nbins];
+    Eigen::Vector2d leftSum = Eigen::Vector2d::Zero();
+    int leftCount = 0;
+
+    double best_error = numeric_limits<double>::max();
+    double split_point = 0;
+    for (int b = 0; b < nbins - 1; ++b) {
+      if (hist[b].count == 0) continue;
+      leftCount += hist[b].count;
+      leftSum += Eigen::Vector2d(hist[b].sum[0], hist[b].sum[1]);
+
+      int rightCount = nsamples - leftCount;
+      if (rightCount == 0) break;
+      double cur_error = sumSquares - leftSum.squaredNorm() / leftCount - (sum - leftSum).squaredNorm() / rightCount;
+      if (cur_error < best_error) {
+        best_error = cur_error;
+        split_point = threshold(b);
+      }
+    }
+    return make_pair(split_point, best_error);
+  }
+
+  int nbins, binWidth;
+  vector<Bin> bins;  // nfeatures x nbins
+};
+
 template <typename InputType=Eigen::VectorXd, typename OutputType=Eigen::Vector2d, typename NodeType=RegressionTreeNode>
 class RegressionTree {
 public:
@@ -22,53 +124,103 @@ public:
   typedef OutputType output_t;
   typedef NodeType node_t;
 
-  RegressionTree(){}
-  RegressionTree(int N, int D, double threshold) :ndims(N), maxDepth(D){}
+  // objective minimized when choosing a split
+  enum SplitObjective {
+    VarianceReduction,  // sum of squared residuals, one linear sweep per candidate feature
+    L2Norm              // sum of residual norms, quadratic per candidate feature
+  };
 
+  // with a positive bin width, splits are searched on histograms of the pixel
+  // differences with bins of that width instead of on the sorted values. the
+  // candidate features are then drawn once per tree so that the histograms of
+  // a node can be derived from those of its parent and sibling, and the split
+  // objective is always variance reduction
+  RegressionTree() :ndims(0), maxDepth(0), threshold(0), objective(VarianceReduction), binWidth(0){}
+  RegressionTree(int N, int D, double threshold, SplitObjective objective = VarianceReduction, int binWidth = 0)
+    :ndims(N), maxDepth(D), threshold(threshold), objective(objective), binWidth(binWidth){}
 
-  void train(const Eigen::MatrixXd &pixels, const Eigen::MatrixXd &ds);
-  OutputType predict(const InputType &sample);
-  vector<bool> localBinaryFeature(const InputType &sample);
+
+  // the seed fully determines the candidate features drawn at each node, so a
+  // tree trains to the same result regardless of which thread runs it
+  template <typename PixelType>
+  void train(const PixelMatrix<PixelType> &pixels, const Eigen::MatrixXd &ds, unsigned int seed = 0);
+  OutputType predict(const InputType &sample) const;
+  vector<bool> localBinaryFeature(const InputType &sample) const;
+
+  // index of the leaf reached by the sample, in [0, 2^D). any type with
+  // operator[] returning the pixel values works as a sample, e.g. a row of the
+  // training pixel matrix or a pointer into a sampled pixel buffer
+  template <typename SampleType>
+  int leafIndex(const SampleType &sample) const;
+  int numLeaves() const { return 1 << maxDepth; }
+  // the 2^D - 1 split nodes of the compiled tree
+  const RegressionTreeFlatNode *flatNodes() const { return nodes.data(); }
 
 protected:
-  shared_ptr<NodeType> trainSubTree(const vector<int> &samples, const Eigen::MatrixXd &pixels, const Eigen::MatrixXd &ds);
-  pair<double, double> findBestSplittingPoint(const vector<int> &samples, int m, int n, const Eigen::MatrixXd &pixels, const Eigen::MatrixXd &ds);
-  bool stopSplitting(const vector<int> &samples, const Eigen::MatrixXd &pixels, const Eigen::MatrixXd &ds, Eigen::Vector2d &meanval);
+  // samples is a range of the index buffer shared by the whole tree, it is
+  // partitioned in place into the ranges of the left and right children
+  template <typename PixelType>
+  shared_ptr<NodeType> trainSubTree(int *samples, int nsamples, int depth, const PixelMatrix<PixelType> &pixels, const Eigen::MatrixXd &ds);
+  // hist holds the histograms of this node on entry and is overwritten
+  template <typename PixelType>
+  shared_ptr<NodeType> trainSubTreeHistogram(int *samples, int nsamples, int depth, RegressionTreeHistogram &hist,
+                                             const vector<pair<int, int>> &dims, const PixelMatrix<PixelType> &pixels, const Eigen::MatrixXd &ds);
+  vector<pair<int, int>> sampleFeatures(int npixels);
+  template <typename PixelType>
+  pair<double, double> findBestSplittingPoint(const int *samples, int nsamples, int m, int n, const PixelMatrix<PixelType> &pixels, const Eigen::MatrixXd &ds);
+  template <typename PixelType>
+  bool stopSplitting(const int *samples, int nsamples, const PixelMatrix<PixelType> &pixels, const Eigen::MatrixXd &ds, Eigen::Vector2d &meanval);
+
+  // flatten the trained tree into a complete binary tree of depth maxDepth
+  void compile();
+  void compileSubTree(const shared_ptr<NodeType> &node, int idx, int depth, int leaf);
 
 private:
   int ndims;
   int maxDepth;
   double threshold; // threshold for stop splitting
-  shared_ptr<NodeType> root;
+  SplitObjective objective;
+  int binWidth;
+  shared_ptr<NodeType> root;  // only alive during training
+  std::default_random_engine generator;
+
+  // compiled inference form: 2^D - 1 split nodes in breadth first order,
+  // 2^D leaf slots mapping to the actual leaves of the trained tree
+  vector<RegressionTreeFlatNode> nodes;
+  vector<int> leaves;
+  vector<OutputType, Eigen::aligned_allocator<OutputType>> outputs;
 };
 
 template <typename InputType, typename OutputType, typename NodeType>
-bool RegressionTree<InputType, OutputType, NodeType>::stopSplitting(const vector<int> &samples, const Eigen::MatrixXd &pixels, const Eigen::MatrixXd &ds, Eigen::Vector2d &meanval)
+template <typename PixelType>
+bool RegressionTree<InputType, OutputType, NodeType>::stopSplitting(const int *samples, int nsamples, const PixelMatrix<PixelType> &pixels, const Eigen::MatrixXd &ds, Eigen::Vector2d &meanval)
 {
-  assert(samples.size() >= 1);
-  if (samples.size() == 1) return true;
+  assert(nsamples >= 1);
+  meanval = Eigen::Vector2d::Zero();
+  if (nsamples == 1) {
+    meanval = ds.row(samples[0]);
+    return true;
+  }
   else {
     // compute the mean value of all samples
-    for (int i = 0; i < samples.size(); ++i) {
+    for (int i = 0; i < nsamples; ++i) {
       meanval += ds.row(samples[i]);
     }
-    meanval /= samples.size();
+    meanval /= nsamples;
 
     double errval = 0;
-    for (int i = 0; i < samples.size(); ++i) {
+    for (int i = 0; i < nsamples; ++i) {
       Eigen::Vector2d diff = Eigen::Vector2d(ds.row(samples[i])) - meanval;
       errval += diff.norm();
     }
-    return errval / samples.size();
+    return errval / nsamples < threshold;
   }
 }
 
 template <typename InputType, typename OutputType, typename NodeType>
-pair<double, double> RegressionTree<InputType, OutputType, NodeType>::findBestSplittingPoint(const vector<int> &samples, int m, int n, const Eigen::MatrixXd &pixels, const Eigen::MatrixXd &ds)
+template <typename PixelType>
+pair<double, double> RegressionTree<InputType, OutputType, NodeType>::findBestSplittingPoint(const int *samples, int nsamples, int m, int n, const PixelMatrix<PixelType> &pixels, const Eigen::MatrixXd &ds)
 {
-  // get all data
-  int nsamples = samples.size();
-
   struct IndexValuePair {
     IndexValuePair(){}
     IndexValuePair(int idx, double val) :idx(idx), val(val){}
@@ -77,7 +229,7 @@ pair<double, double> RegressionTree<InputType, OutputType, NodeType>::findBestSp
   };
   vector<IndexValuePair> values(nsamples);
   for (int i = 0; i < nsamples; ++i) {
-    values[i] = IndexValuePair(i, pixels(samples[i], m) - pixels(samples[i], n));
+    values[i] = IndexValuePair(samples[i], pixels(samples[i], m) - pixels(samples[i], n));
   }
 
   // sort the values
@@ -86,15 +238,18 @@ pair<double, double> RegressionTree<InputType, OutputType, NodeType>::findBestSp
   });
 
   // find the best splitting point
-  OutputType leftSum, rightSum;
+  OutputType leftSum = OutputType::Zero(), rightSum = OutputType::Zero();
+  double sumSquares = 0;
   for (int i = 0; i < nsamples; ++i) {
-    rightSum += ds.row(samples[i]);
+    rightSum += ds.row(values[i].idx);
+    sumSquares += ds.row(values[i].idx).squaredNorm();
   }
 
+  // sum of the L2 norms of the residuals in [startIdx, endIdx], linear in the number of samples
   auto computeError = [&](int startIdx, int endIdx, const Eigen::Vector2d &meanval) {
     double errval = 0;
     for (int i = startIdx; i <= endIdx; ++i) {
-      Eigen::Vector2d diff = Eigen::Vector2d(ds.row(samples[values[startIdx].idx])) - meanval;
+      Eigen::Vector2d diff = Eigen::Vector2d(ds.row(values[i].idx)) - meanval;
       errval += diff.norm();
     }
     return errval;
@@ -103,15 +258,25 @@ pair<double, double> RegressionTree<InputType, OutputType, NodeType>::findBestSp
   double best_error = numeric_limits<double>::max();
   double split_point = 0;
   for (int i = 0; i < nsamples-1; ++i) {
-    leftSum += ds.row(i);
-    rightSum -= ds.row(i);
+    leftSum += ds.row(values[i].idx);
+    rightSum -= ds.row(values[i].idx);
+
+    // can not split between identical values
+    if (values[i].val == values[i+1].val) continue;
 
-    // left error
     int leftCount = i + 1;
     int rightCount = nsamples - leftCount;
-    double left_error = computeError(0, i, leftSum / leftCount);
-    double right_error = computeError(i+1, nsamples-1, rightSum / rightCount);
-    double cur_error = left_error + right_error;
+    double cur_error;
+    if (objective == VarianceReduction) {
+      // sum of squared residuals of both sides from the running sums:
+      // sum |x - mean|^2 = sum |x|^2 - |sum x|^2 / count
+      cur_error = sumSquares - leftSum.squaredNorm() / leftCount - rightSum.squaredNorm() / rightCount;
+    }
+    else {
+      double left_error = computeError(0, i, leftSum / leftCount);
+      double right_error = computeError(i+1, nsamples-1, rightSum / rightCount);
+      cur_error = left_error + right_error;
+    }
     if (cur_error < best_error) {
       best_error = cur_error;
       split_point = (values[i].val + values[i+1].val)*0.5;
@@ -122,37 +287,27 @@ pair<double, double> RegressionTree<InputType, OutputType, NodeType>::findBestSp
 }
 
 template <typename InputType, typename OutputType, typename NodeType>
-shared_ptr<NodeType> RegressionTree<InputType, OutputType, NodeType>::trainSubTree(const vector<int> &samples, const Eigen::MatrixXd &pixels, const Eigen::MatrixXd &ds)
+template <typename PixelType>
+shared_ptr<NodeType> RegressionTree<InputType, OutputType, NodeType>::trainSubTree(int *samples, int nsamples, int depth, const PixelMatrix<PixelType> &pixels, const Eigen::MatrixXd &ds)
 {
   // test if further splitting is necessary
   Eigen::Vector2d meanval;
-  if (stopSplitting(samples, pixels, ds, meanval)) {
+  if (stopSplitting(samples, nsamples, pixels, ds, meanval) || depth >= maxDepth) {
     // no splitting needed, just create a node here
     shared_ptr<NodeType> node(new NodeType);
-    node->samples = samples;
     node->output = meanval;
     return node;
   }
   else {
     // get a subset of available dimensions
-    std::default_random_engine generator;
-    std::uniform_int_distribution<int> distribution(0, pixels.cols()-1);
-
-    set<pair<int,int>> dims;
-    while (dims.size() < ndims) {
-      int m = distribution(generator);
-      int n = distribution(generator);
-      if (m != n) {
-        dims.insert(make_pair(m, n));
-      }
-    }
+    vector<pair<int, int>> dims = sampleFeatures(pixels.cols());
 
     // find the best splitting dimension and split value
     double best_error = numeric_limits<double>::max();
     double best_split = 0;
     pair<int, int> pix_pair;
     for (auto d : dims) {
-      auto res = findBestSplittingPoint(samples, d.first, d.second, pixels, ds);
+      auto res = findBestSplittingPoint(samples, nsamples, d.first, d.second, pixels, ds);
       if (res.second < best_error) {
         best_error = res.second;
         best_split = res.first;
@@ -160,36 +315,190 @@ shared_ptr<NodeType> RegressionTree<InputType, OutputType, NodeType>::trainSubTr
       }
     }
 
-    // split the samples into two sub sets, and build the tree recursively
-    vector<int> lset, rset;
-    lset.reserve(samples.size());
-    rset.reserve(samples.size());
-    for (int i = 0; i < samples.size(); ++i) {
-      if (pixels(samples[i], pix_pair.first) - pixels(samples[i], pix_pair.second)  < best_split) lset.push_back(samples[i]);
-      else rset.push_back(samples[i]);
+    // all candidate features are constant over the samples, make this a leaf
+    if (best_error == numeric_limits<double>::max()) {
+      shared_ptr<NodeType> node(new NodeType);
+      node->output = meanval;
+      return node;
     }
 
+    // split the samples into two sub ranges in place, and build the tree recursively
+    int *mid = std::partition(samples, samples + nsamples, [&](int s) {
+      return pixels(s, pix_pair.first) - pixels(s, pix_pair.second) < best_split;
+    });
+    int nleft = mid - samples;
+
     shared_ptr<NodeType> node(new NodeType);
-    node->samples = samples;
     node->m = pix_pair.first; node->n = pix_pair.second;
     node->splitVal = best_split;
-    node->lchild = trainSubTree(lset, pixels, ds);
-    node->rchild = trainSubTree(rset, pixels, ds);
+    node->lchild = trainSubTree(samples, nleft, depth + 1, pixels, ds);
+    node->rchild = trainSubTree(mid, nsamples - nleft, depth + 1, pixels, ds);
+    return node;
+  }
+}
+
+template <typename InputType, typename OutputType, typename NodeType>
+template <typename PixelType>
+shared_ptr<NodeType> RegressionTree<InputType, OutputType, NodeType>::trainSubTreeHistogram(int *samples, int nsamples, int depth, RegressionTreeHistogram &hist,
+                                                                                            const vector<pair<int, int>> &dims, const PixelMatrix<PixelType> &pixels, const Eigen::MatrixXd &ds)
+{
+  // test if further splitting is necessary
+  Eigen::Vector2d meanval;
+  if (stopSplitting(samples, nsamples, pixels, ds, meanval) || depth >= maxDepth) {
+    shared_ptr<NodeType> node(new NodeType);
+    node->output = meanval;
+    return node;
+  }
+
+  double sumSquares = 0;
+  for (int i = 0; i < nsamples; ++i) {
+    sumSquares += ds.row(samples[i]).squaredNorm();
+  }
+  Eigen::Vector2d sum = meanval * nsamples;
+
+  // find the best splitting dimension and split value
+  double best_error = numeric_limits<double>::max();
+  double best_split = 0;
+  pair<int, int> pix_pair;
+  for (int f = 0; f < dims.size(); ++f) {
+    auto res = hist.findBestSplit(f, nsamples, sum, sumSquares);
+    if (res.second < best_error) {
+      best_error = res.second;
+      best_split = res.first;
+      pix_pair = dims[f];
+    }
+  }
+
+  // all candidate features are constant over the samples, make this a leaf
+  if (best_error == numeric_limits<double>::max()) {
+    shared_ptr<NodeType> node(new NodeType);
+    node->output = meanval;
     return node;
   }
+
+  int *mid = std::partition(samples, samples + nsamples, [&](int s) {
+    return pixels(s, pix_pair.first) - pixels(s, pix_pair.second) < best_split;
+  });
+  int nleft = mid - samples;
+  int nright = nsamples - nleft;
+
+  shared_ptr<NodeType> node(new NodeType);
+  node->m = pix_pair.first; node->n = pix_pair.second;
+  node->splitVal = best_split;
+
+  // only the histograms of the smaller child are built from its samples, the
+  // parent histograms are turned into those of the larger child in place
+  RegressionTreeHistogram smaller;
+  if (depth + 1 < maxDepth) {
+    if (nleft < nright) smaller.build(samples, nleft, dims, binWidth, pixels, ds);
+    else smaller.build(mid, nright, dims, binWidth, pixels, ds);
+    hist.subtract(smaller);
+  }
+  RegressionTreeHistogram &lhist = nleft < nright ? smaller : hist;
+  RegressionTreeHistogram &rhist = nleft < nright ? hist : smaller;
+  node->lchild = trainSubTreeHistogram(samples, nleft, depth + 1, lhist, dims, pixels, ds);
+  node->rchild = trainSubTreeHistogram(mid, nright, depth + 1, rhist, dims, pixels, ds);
+  return node;
 }
 
 template <typename InputType, typename OutputType, typename NodeType>
-void RegressionTree<InputType, OutputType, NodeType>::train(const Eigen::MatrixXd &pixels, const Eigen::MatrixXd &ds)
+vector<pair<int, int>> RegressionTree<InputType, OutputType, NodeType>::sampleFeatures(int npixels)
 {
+  std::uniform_int_distribution<int> distribution(0, npixels-1);
+
+  set<pair<int,int>> dims;
+  while (dims.size() < ndims) {
+    int m = distribution(generator);
+    int n = distribution(generator);
+    if (m != n) {
+      dims.insert(make_pair(m, n));
+    }
+  }
+  return vector<pair<int, int>>(dims.begin(), dims.end());
+}
+
+template <typename InputType, typename OutputType, typename NodeType>
+template <typename PixelType>
+void RegressionTree<InputType, OutputType, NodeType>::train(const PixelMatrix<PixelType> &pixels, const Eigen::MatrixXd &ds, unsigned int seed)
+{
+  generator.seed(seed);
   int n = pixels.rows();
   vector<int> indices(n);
   for (int i = 0; i < n; ++i) indices[i] = i;
-  root = trainSubTree(indices, pixels, ds);
+  if (binWidth > 0) {
+    vector<pair<int, int>> dims = sampleFeatures(pixels.cols());
+    RegressionTreeHistogram hist;
+    hist.build(indices.data(), n, dims, binWidth, pixels, ds);
+    root = trainSubTreeHistogram(indices.data(), n, 0, hist, dims, pixels, ds);
+  }
+  else {
+    root = trainSubTree(indices.data(), n, 0, pixels, ds);
+  }
+  compile();
+
+  // inference only uses the compiled form, drop the node graph
+  root.reset();
 }
 
 template <typename InputType, typename OutputType, typename NodeType>
-OutputType RegressionTree<InputType, OutputType, NodeType>::predict(const InputType &sample)
+void RegressionTree<InputType, OutputType, NodeType>::compile()
 {
+  assert(maxDepth < 16);
+  nodes.assign((1 << maxDepth) - 1, RegressionTreeFlatNode());
+  leaves.assign(1 << maxDepth, 0);
+  outputs.clear();
+  compileSubTree(root, 0, 0, -1);
+}
 
+template <typename InputType, typename OutputType, typename NodeType>
+void RegressionTree<InputType, OutputType, NodeType>::compileSubTree(const shared_ptr<NodeType> &node, int idx, int depth, int leaf)
+{
+  // a leaf above the maximum depth is padded with pass-through nodes that
+  // always go left, every slot below it maps to the same leaf
+  if (leaf < 0 && node->isLeaf()) {
+    leaf = outputs.size();
+    outputs.push_back(node->output);
+  }
+
+  if (depth == maxDepth) {
+    leaves[idx - nodes.size()] = leaf;
+    return;
+  }
+
+  RegressionTreeFlatNode &fnode = nodes[idx];
+  if (leaf >= 0) {
+    fnode.m = fnode.n = 0;
+    fnode.threshold = numeric_limits<float>::max();
+    compileSubTree(node, idx * 2 + 1, depth + 1, leaf);
+    compileSubTree(node, idx * 2 + 2, depth + 1, leaf);
+  }
+  else {
+    assert(node->m <= numeric_limits<int16_t>::max() && node->n <= numeric_limits<int16_t>::max());
+    fnode.m = node->m;
+    fnode.n = node->n;
+    fnode.threshold = node->splitVal;
+    compileSubTree(node->lchild, idx * 2 + 1, depth + 1, -1);
+    compileSubTree(node->rchild, idx * 2 + 2, depth + 1, -1);
+  }
+}
+
+template <typename InputType, typename OutputType, typename NodeType>
+template <typename SampleType>
+int RegressionTree<InputType, OutputType, NodeType>::leafIndex(const SampleType &sample) const
+{
+  return flatTreeLeafIndex(nodes.data(), maxDepth, sample);
+}
+
+template <typename InputType, typename OutputType, typename NodeType>
+OutputType RegressionTree<InputType, OutputType, NodeType>::predict(const InputType &sample) const
+{
+  return outputs[leaves[leafIndex(sample)]];
+}
+
+template <typename InputType, typename OutputType, typename NodeType>
+vector<bool> RegressionTree<InputType, OutputType, NodeType>::localBinaryFeature(const InputType &sample) const
+{
+  vector<bool> feature(numLeaves(), false);
+  feature[leafIndex(sample)] = true;
+  return feature;
 }
@@ -0,0 +1,57 @@
+#include <iostream>
+using namespace std;
+
+#define CATCH_CONFIG_MAIN
+#include "../extras/Catch/single_include/catch.hpp"
+
+#include "../datasetcache.h"
+
+TEST_CASE("Tests for the preprocessed dataset cache", "[DatasetCache]") {
+  const int nfaces = 3, Lfp = 10, side = 23;
+  const string filename = "test_faces.bin";
+  const uint64_t settingsHash = DatasetCache::hash("settings");
+
+  vector<cv::Mat> faces;
+  vector<Eigen::VectorXd> points;
+  DatasetCache::Writer writer;
+  REQUIRE( writer.open(filename, settingsHash, Lfp, side) );
+  for (int i = 0; i < nfaces; ++i) {
+    cv::Mat face(side, side, CV_8UC1);
+    for (int y = 0; y < side; ++y)
+      for (int x = 0; x < side; ++x)
+        face.at<uchar>(y, x) = (x * 7 + y * 13 + i) & 0xff;
+    faces.push_back(face);
+    points.push_back(Eigen::VectorXd::Random(Lfp));
+    const int box[4] = { i, i + 1, i + 100, i + 101 };
+    REQUIRE( writer.append(box, points.back(), face) );
+  }
+
+  SECTION( "An unfinished cache is rejected" ) {
+    DatasetCache::Reader reader;
+    REQUIRE( !reader.open(filename) );
+  }
+
+  REQUIRE( writer.close() );
+
+  SECTION( "Faces are used in place" ) {
+    DatasetCache::Reader reader;
+    REQUIRE( reader.open(filename) );
+    REQUIRE( reader.header().settingsHash == settingsHash );
+    REQUIRE( reader.header().nfaces == nfaces );
+    REQUIRE( reader.header().side == side );
+    for (int i = 0; i < nfaces; ++i) {
+      REQUIRE( reader.box(i)[0] == i );
+      REQUIRE( reader.box(i)[3] == i + 101 );
+      REQUIRE( reinterpret_cast<uintptr_t>(reader.points(i)) % 8 == 0 );
+      REQUIRE( Eigen::Map<const Eigen::VectorXd>(reader.points(i), Lfp) == points[i] );
+      cv::Mat face = reader.face(i);
+      for (int y = 0; y < side; ++y)
+        for (int x = 0; x < side; ++x)
+          REQUIRE( face.at<uchar>(y, x) == faces[i].at<uchar>(y, x) );
+    }
+  }
+
+  SECTION( "Different settings have different hashes" ) {
+    REQUIRE( DatasetCache::hash("settings") != DatasetCache::hash("settings2") );
+  }
+}
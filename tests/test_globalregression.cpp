@@ -0,0 +1,89 @@
+#include <iostream>
+#include <omp.h>
+using namespace std;
+
+#define CATCH_CONFIG_MAIN
+#include "../extras/Catch/single_include/catch.hpp"
+
+#include "../globalregression.h"
+
+TEST_CASE("Tests for global regression on binary features", "[GlobalRegression]") {
+  const int nsamples = 400, ntrees = 3, nleaves = 4, noutputs = 6;
+
+  std::default_random_engine e(0);
+  std::uniform_int_distribution<int> leaf(0, nleaves - 1);
+
+  // targets are an exact sum of per leaf contributions
+  RowMatrixXd Wref = RowMatrixXd::Random(ntrees * nleaves, noutputs);
+  BinaryFeatures features(nsamples, ntrees, nleaves);
+  Eigen::MatrixXd targets = Eigen::MatrixXd::Zero(nsamples, noutputs);
+  for (int i = 0; i < nsamples; ++i) {
+    for (int k = 0; k < ntrees; ++k) {
+      features.leaves(i, k) = leaf(e);
+      targets.row(i) += Wref.row(k * nleaves + features.leaves(i, k));
+    }
+  }
+
+  SECTION( "Fit" ) {
+    RowMatrixXd W = GlobalRegression::trainRidge(features, targets, 1e-6, 50);
+    Eigen::MatrixXd pred = GlobalRegression::predict(features, W);
+    REQUIRE( (pred - targets).norm() / targets.norm() < 1e-3 );
+  }
+
+  SECTION( "SVR fit" ) {
+    RowMatrixXd W;
+    REQUIRE( GlobalRegression::trainSVR(features, targets, 100, 1e-4, 0, W) );
+    Eigen::MatrixXd pred = GlobalRegression::predict(features, W);
+    REQUIRE( (pred - targets).norm() / targets.norm() < 1e-2 );
+  }
+
+  SECTION( "SVR is reproducible" ) {
+    RowMatrixXd W1, W2, W3;
+    REQUIRE( GlobalRegression::trainSVR(features, targets, 1, 0.1, 7, W1) );
+    REQUIRE( GlobalRegression::trainSVR(features, targets, 1, 0.1, 7, W2) );
+    REQUIRE( W1 == W2 );
+
+    // the outputs are solved in parallel, the result must not depend on the threads
+    const int nthreads = omp_get_max_threads();
+    omp_set_num_threads(1);
+    REQUIRE( GlobalRegression::trainSVR(features, targets, 1, 0.1, 7, W3) );
+    omp_set_num_threads(nthreads);
+    REQUIRE( W1 == W3 );
+  }
+
+  SECTION( "SVR rejects invalid parameters" ) {
+    RowMatrixXd W;
+    REQUIRE( !GlobalRegression::trainSVR(features, targets, -1, 0.1, 0, W) );
+  }
+
+  SECTION( "Regularization shrinks the weights" ) {
+    RowMatrixXd W = GlobalRegression::trainRidge(features, targets, 1e-6, 50);
+    RowMatrixXd Wreg = GlobalRegression::trainRidge(features, targets, 100, 50);
+    REQUIRE( Wreg.norm() < W.norm() );
+  }
+
+  SECTION( "Single sample accumulation" ) {
+    Eigen::MatrixXd pred = GlobalRegression::predict(features, Wref);
+    for (int i = 0; i < nsamples; ++i) {
+      vector<uint16_t> leaves(ntrees);
+      for (int k = 0; k < ntrees; ++k) leaves[k] = features.leaves(i, k);
+      Eigen::VectorXd inc = Eigen::VectorXd::Zero(noutputs);
+      GlobalRegression::accumulate(Wref, leaves.data(), ntrees, nleaves, inc.data());
+      REQUIRE( (inc - targets.row(i).transpose()).norm() < 1e-9 );
+      REQUIRE( (inc - pred.row(i).transpose()).norm() < 1e-9 );
+    }
+  }
+
+  SECTION( "Quantized weights" ) {
+    QuantizedRowMatrix Wq;
+    Wq.quantize(Wref);
+    RowMatrixXd Wdq = Wq.dequantize();
+    for (int j = 0; j < Wref.rows(); ++j) {
+      REQUIRE( (Wdq.row(j) - Wref.row(j)).cwiseAbs().maxCoeff() <= Wq.scales[j] * 0.5 + 1e-12 );
+    }
+
+    Eigen::MatrixXd pred = GlobalRegression::predict(features, Wref);
+    Eigen::MatrixXd predq = GlobalRegression::predict(features, Wq);
+    REQUIRE( (pred - predq).cwiseAbs().maxCoeff() < 1e-3 );
+  }
+}
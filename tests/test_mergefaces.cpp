@@ -0,0 +1,82 @@
+#include <algorithm>
+#include <iostream>
+#include <random>
+using namespace std;
+
+#define CATCH_CONFIG_MAIN
+#include "../extras/Catch/single_include/catch.hpp"
+
+#include "../extras/libface/src/LibFaceUtils.h"
+using libface::Face;
+using libface::LibFaceUtils;
+
+// the quadratic merge FaceDetect::mergeFaces used before the grid
+static vector<Face> mergeQuadratic(vector<Face> faces, int maxdist, int mindups) {
+  vector<int> genuineness;
+  for (unsigned int i = 0; i < faces.size(); ++i) {
+    int duplicates = 0;
+    for (unsigned int j = i + 1; j < faces.size(); ++j) {
+      if (LibFaceUtils::distance(faces[i], faces[j]) < maxdist) {
+        faces.erase(faces.begin() + j);
+        duplicates++;
+        j--;
+      }
+    }
+    genuineness.push_back(duplicates);
+    if (duplicates < mindups) {
+      genuineness.erase(genuineness.begin() + i);
+      faces.erase(faces.begin() + i);
+      i--;
+    }
+  }
+  return faces;
+}
+
+static bool sameFaces(const vector<Face> &a, const vector<Face> &b) {
+  if (a.size() != b.size()) return false;
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (a[i].getX1() != b[i].getX1() || a[i].getY1() != b[i].getY1()
+        || a[i].getX2() != b[i].getX2() || a[i].getY2() != b[i].getY2()) return false;
+  }
+  return true;
+}
+
+TEST_CASE("Tests for merging duplicate face detections", "[MergeFaces]") {
+  SECTION( "Close faces are merged into the first one" ) {
+    vector<Face> faces;
+    faces.push_back(Face(0, 0, 20, 20));
+    faces.push_back(Face(100, 100, 120, 120));
+    faces.push_back(Face(2, 2, 22, 22));
+    faces.push_back(Face(1, 0, 21, 20));
+    vector<Face> merged = LibFaceUtils::mergeDuplicates(faces, 10, 1);
+    REQUIRE( merged.size() == 1 );
+    REQUIRE( merged[0].getX1() == 0 );
+    REQUIRE( merged[0].getY1() == 0 );
+  }
+
+  SECTION( "The grid merges like the quadratic merge" ) {
+    mt19937 rng(42);
+    for (int iter = 0; iter < 2000; ++iter) {
+      // clustered detections, some of them near the cell borders and at negative coordinates
+      const int maxdist = uniform_int_distribution<int>(0, 40)(rng);
+      const int mindups = uniform_int_distribution<int>(0, 3)(rng);
+      const int nclusters = uniform_int_distribution<int>(1, 5)(rng);
+      vector<Face> faces;
+      for (int c = 0; c < nclusters; ++c) {
+        const int cx = uniform_int_distribution<int>(-50, 300)(rng);
+        const int cy = uniform_int_distribution<int>(-50, 300)(rng);
+        const int n = uniform_int_distribution<int>(1, 8)(rng);
+        for (int k = 0; k < n; ++k) {
+          const int size = uniform_int_distribution<int>(10, 80)(rng);
+          const int x = cx + uniform_int_distribution<int>(-maxdist - 5, maxdist + 5)(rng);
+          const int y = cy + uniform_int_distribution<int>(-maxdist - 5, maxdist + 5)(rng);
+          faces.push_back(Face(x, y, x + size, y + size));
+        }
+      }
+      shuffle(faces.begin(), faces.end(), rng);
+
+      REQUIRE( sameFaces(LibFaceUtils::mergeDuplicates(faces, maxdist, mindups),
+                         mergeQuadratic(faces, maxdist, mindups)) );
+    }
+  }
+}
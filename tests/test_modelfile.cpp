@@ -0,0 +1,158 @@
+#include <iostream>
+using namespace std;
+
+#define CATCH_CONFIG_MAIN
+#include "../extras/Catch/single_include/catch.hpp"
+
+#include "../modelfile.h"
+
+TEST_CASE("Tests for the binary model file", "[ModelFile]") {
+  ModelFile::Header header;
+  memset(&header, 0, sizeof(header));
+  header.windowSize = 256;
+  header.T = 3;
+  header.N = 4;
+  header.D = 3;
+  header.Npixels = 10;
+  header.Nfp = 5;
+
+  ModelFile::StageSizes sizes(header);
+  Eigen::VectorXd meanshape = Eigen::VectorXd::Random(header.Nfp * 2);
+
+  vector<float> ox(sizes.offsets), oy(sizes.offsets), scales(sizes.rows);
+  vector<RegressionTreeFlatNode> nodes(sizes.nodes);
+  vector<int16_t> weights(sizes.weights);
+  for (size_t i = 0; i < sizes.offsets; ++i) { ox[i] = i; oy[i] = -(float)i; }
+  for (size_t i = 0; i < sizes.nodes; ++i) { nodes[i].m = i % 10; nodes[i].n = i % 7; nodes[i].threshold = i * 0.5f; }
+  for (size_t i = 0; i < sizes.rows; ++i) scales[i] = i * 0.25f;
+  for (size_t i = 0; i < sizes.weights; ++i) weights[i] = (int16_t)(i * 7);
+
+  const string filename = "test_model.bin";
+  ModelFile::Writer writer;
+  REQUIRE( writer.open(filename, header, meanshape) );
+  REQUIRE( writer.appendStage(ox.data(), oy.data(), nodes.data(), scales.data(), weights.data()) );
+
+  SECTION( "Partial model" ) {
+    ModelFile::Reader reader;
+    REQUIRE( reader.open(filename) );
+    REQUIRE( reader.header().T == 3 );
+    REQUIRE( reader.header().nstages == 1 );
+    REQUIRE( reader.stages().size() == 1 );
+  }
+
+  REQUIRE( writer.appendStage(ox.data(), oy.data(), nodes.data(), scales.data(), weights.data()) );
+  writer.close();
+
+  SECTION( "Data is used in place" ) {
+    ModelFile::Reader reader;
+    REQUIRE( reader.open(filename) );
+    REQUIRE( reader.header().nstages == 2 );
+    REQUIRE( reader.header().N == 4 );
+    REQUIRE( reader.header().Nfp == 5 );
+    REQUIRE( Eigen::Map<const Eigen::VectorXd>(reader.meanshape(), meanshape.rows()) == meanshape );
+    for (auto &stage : reader.stages()) {
+      REQUIRE( reinterpret_cast<uintptr_t>(stage.weights) % ModelFile::alignment == 0 );
+      REQUIRE( std::equal(ox.begin(), ox.end(), stage.ox) );
+      REQUIRE( std::equal(oy.begin(), oy.end(), stage.oy) );
+      REQUIRE( memcmp(nodes.data(), stage.nodes, nodes.size() * sizeof(RegressionTreeFlatNode)) == 0 );
+      REQUIRE( std::equal(scales.begin(), scales.end(), stage.scales) );
+      REQUIRE( std::equal(weights.begin(), weights.end(), stage.weights) );
+      REQUIRE( stage.reference == nullptr );
+    }
+  }
+
+  SECTION( "Weights before quantization" ) {
+    vector<float> reference(sizes.weights);
+    for (size_t i = 0; i < sizes.weights; ++i) reference[i] = i * 0.125f;
+
+    ModelFile::Writer resumed;
+    REQUIRE( resumed.resume(filename, header, meanshape, 1) );
+    REQUIRE( resumed.appendStage(ox.data(), oy.data(), nodes.data(), scales.data(), weights.data(), reference.data()) );
+    resumed.close();
+
+    ModelFile::Reader reader;
+    REQUIRE( reader.open(filename) );
+    REQUIRE( reader.stages().size() == 2 );
+    REQUIRE( reader.stages()[0].reference == nullptr );
+    REQUIRE( reinterpret_cast<uintptr_t>(reader.stages()[1].reference) % ModelFile::alignment == 0 );
+    REQUIRE( std::equal(reference.begin(), reference.end(), reader.stages()[1].reference) );
+    REQUIRE( std::equal(weights.begin(), weights.end(), reader.stages()[1].weights) );
+  }
+
+  SECTION( "Training resumes after a stage" ) {
+    ModelFile::Writer resumed;
+    REQUIRE( resumed.resume(filename, header, meanshape, 1) );
+    {
+      ModelFile::Reader reader;
+      REQUIRE( reader.open(filename) );
+      REQUIRE( reader.header().nstages == 1 );
+    }
+    REQUIRE( resumed.appendStage(ox.data(), oy.data(), nodes.data(), scales.data(), weights.data()) );
+    resumed.close();
+
+    ModelFile::Reader reader;
+    REQUIRE( reader.open(filename) );
+    REQUIRE( reader.header().nstages == 2 );
+    REQUIRE( std::equal(weights.begin(), weights.end(), reader.stages().back().weights) );
+    REQUIRE( !resumed.resume(filename, header, meanshape, 3) );
+  }
+
+  SECTION( "Training with other parameters does not resume" ) {
+    ModelFile::Writer resumed;
+    ModelFile::Header other = header;
+    other.Npixels = 20;
+    REQUIRE( !resumed.resume(filename, other, meanshape, 1) );
+    other = header;
+    other.T = 4;
+    REQUIRE( !resumed.resume(filename, other, meanshape, 1) );
+    REQUIRE( !resumed.resume(filename, header, Eigen::VectorXd::Zero(meanshape.rows()), 1) );
+
+    ModelFile::Reader reader;
+    REQUIRE( reader.open(filename) );
+    REQUIRE( reader.header().nstages == 2 );
+  }
+
+  SECTION( "Invalid files are rejected" ) {
+    ofstream f("test_invalid.bin", ios::binary);
+    f << "this is not a model file, this is not a model file, this is not a model file";
+    f.close();
+    ModelFile::Reader reader;
+    REQUIRE( !reader.open("test_invalid.bin") );
+    REQUIRE( !reader.open("test_missing.bin") );
+
+    // a valid model file with one field changed at a time
+    ifstream in(filename, ios::binary);
+    const string valid((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    in.close();
+    auto rejects = [&](const string &contents) {
+      ofstream out("test_invalid.bin", ios::binary);
+      out.write(contents.data(), contents.size());
+      out.close();
+      ModelFile::Reader reader;
+      return !reader.open("test_invalid.bin");
+    };
+    auto withHeader = [&](void (*change)(ModelFile::Header &)) {
+      string contents = valid;
+      change(*reinterpret_cast<ModelFile::Header *>(&contents[0]));
+      return contents;
+    };
+    auto withStage = [&](void (*change)(ModelFile::StageEntry &)) {
+      string contents = valid;
+      change(*reinterpret_cast<ModelFile::StageEntry *>(&contents[sizeof(ModelFile::Header)]));
+      return contents;
+    };
+    REQUIRE( !rejects(valid) );
+    REQUIRE( rejects(withHeader([](ModelFile::Header &h) { h.D = 16; })) );
+    REQUIRE( rejects(withHeader([](ModelFile::Header &h) { h.D = 0; })) );
+    REQUIRE( rejects(withHeader([](ModelFile::Header &h) { h.N = -1; })) );
+    REQUIRE( rejects(withHeader([](ModelFile::Header &h) { h.Nfp = 0; })) );
+    REQUIRE( rejects(withHeader([](ModelFile::Header &h) { h.nstages = h.T + 1; })) );
+    REQUIRE( rejects(withHeader([](ModelFile::Header &h) { h.T = 1 << 30; })) );
+    REQUIRE( rejects(withHeader([](ModelFile::Header &h) { h.Npixels = 1 << 30; })) );
+    REQUIRE( rejects(withStage([](ModelFile::StageEntry &e) { e.weights += 2; })) );
+    REQUIRE( rejects(withStage([](ModelFile::StageEntry &e) { e.nodes = 0; })) );
+    REQUIRE( rejects(withStage([](ModelFile::StageEntry &e) { e.ox = ~(uint64_t)0 - 63; })) );
+    REQUIRE( rejects(withStage([](ModelFile::StageEntry &e) { e.reference = 1 << 20; })) );
+    REQUIRE( rejects(valid.substr(0, valid.size() - 1)) );
+  }
+}
@@ -0,0 +1,75 @@
+#include <iostream>
+using namespace std;
+
+#define CATCH_CONFIG_MAIN
+#include "../extras/Catch/single_include/catch.hpp"
+
+#include "../pixelsampler.h"
+
+TEST_CASE("Tests for shape-indexed pixel sampling", "[PixelSampler]") {
+  const int rows = 37, cols = 53, nlandmarks = 3, npixels = 101;
+
+  cv::Mat img(rows, cols, CV_8UC1);
+  for (int y = 0; y < rows; ++y)
+    for (int x = 0; x < cols; ++x)
+      img.at<uchar>(y, x) = (x * 7 + y * 13) & 0xff;
+
+  Eigen::VectorXd shape(nlandmarks * 2);
+  shape << 10, 10, 26, 18, 50, 35;
+
+  SECTION( "Integer offsets with identity transform" ) {
+    PixelSampler sampler(nlandmarks, npixels);
+    for (int l = 0; l < nlandmarks; ++l) {
+      Eigen::MatrixXd locations(npixels, 2);
+      for (int j = 0; j < npixels; ++j) {
+        locations(j, 0) = j % 11 - 5;
+        locations(j, 1) = j / 11 - 4;
+      }
+      sampler.setLocations(l, locations);
+    }
+
+    vector<uint8_t> values(nlandmarks * npixels);
+    sampler.sample(img, shape, Eigen::Matrix2d::Identity(), values.data());
+    for (int l = 0; l < nlandmarks; ++l) {
+      for (int j = 0; j < npixels; ++j) {
+        int x = std::min(std::max((int)shape[l * 2] + j % 11 - 5, 0), cols - 1);
+        int y = std::min(std::max((int)shape[l * 2 + 1] + j / 11 - 4, 0), rows - 1);
+        REQUIRE( values[l * npixels + j] == img.at<uchar>(y, x) );
+      }
+    }
+  }
+
+  SECTION( "Vectorized sampling matches the scalar reference" ) {
+    std::default_random_engine e(0);
+    std::normal_distribution<float> randn(0, 20);
+    vector<float> ox(npixels), oy(npixels);
+    for (int j = 0; j < npixels; ++j) {
+      ox[j] = randn(e);
+      oy[j] = randn(e);
+    }
+    const float m[4] = { 0.9f, -0.3f, 0.3f, 0.9f };
+
+    vector<uint8_t> ref(npixels), values(npixels);
+    PixelSampler::sampleScalar(img.data, img.step, img.cols, img.rows, ox.data(), oy.data(), npixels, 26.3f, 18.7f, m, ref.data());
+#ifdef PIXELSAMPLER_AVX2
+    if (PixelSampler::hasAVX2()) {
+      PixelSampler::sampleAVX2(img.data, img.step, img.cols, img.rows, ox.data(), oy.data(), npixels, 26.3f, 18.7f, m, values.data());
+      REQUIRE( values == ref );
+    }
+#endif
+
+    PixelSampler sampler(1, npixels);
+    Eigen::MatrixXd locations(npixels, 2);
+    for (int j = 0; j < npixels; ++j) {
+      locations(j, 0) = ox[j];
+      locations(j, 1) = oy[j];
+    }
+    sampler.setLocations(0, locations);
+    Eigen::Matrix2d invM;
+    invM << m[0], m[1], m[2], m[3];
+    Eigen::VectorXd pt(2);
+    pt << 26.3f, 18.7f;
+    sampler.sampleLandmark(img, pt, invM, 0, values.data());
+    REQUIRE( values == ref );
+  }
+}
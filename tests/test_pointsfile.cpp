@@ -0,0 +1,61 @@
+#include <iostream>
+using namespace std;
+
+#define CATCH_CONFIG_MAIN
+#include "../extras/Catch/single_include/catch.hpp"
+
+#include "../pointsfile.h"
+
+TEST_CASE("Tests for the landmark files", "[PointsFile]") {
+  const string text = "version: 1\r\nn_points:  3\r\n{\r\n12.5 -3\r\n0.1 1e2\r\n446.875 2.5E-1\r\n}\r\n";
+
+  SECTION( "Parsing a .pts file" ) {
+    Eigen::VectorXd pts;
+    REQUIRE( PointsFile::parsePts(text.data(), text.data() + text.size(), pts) );
+    REQUIRE( pts.rows() == 6 );
+    REQUIRE( pts[0] == 12.5 );
+    REQUIRE( pts[1] == -3 );
+    REQUIRE( pts[2] == 0.1 );
+    REQUIRE( pts[3] == 100 );
+    REQUIRE( pts[4] == 446.875 );
+    REQUIRE( pts[5] == 0.25 );
+  }
+
+  SECTION( "Malformed files are rejected" ) {
+    Eigen::VectorXd pts;
+    // truncated before the last point and before the closing brace
+    string truncated = text.substr(0, text.find("446"));
+    REQUIRE( !PointsFile::parsePts(truncated.data(), truncated.data() + truncated.size(), pts) );
+    truncated = text.substr(0, text.find("}"));
+    REQUIRE( !PointsFile::parsePts(truncated.data(), truncated.data() + truncated.size(), pts) );
+    string nocount = "version: 1\n{\n1 2\n}\n";
+    REQUIRE( !PointsFile::parsePts(nocount.data(), nocount.data() + nocount.size(), pts) );
+    string garbage = "version: 1\nn_points: 1\n{\n1 x\n}\n";
+    REQUIRE( !PointsFile::parsePts(garbage.data(), garbage.data() + garbage.size(), pts) );
+  }
+
+  SECTION( "Reading a .pts file" ) {
+    ofstream("test_points.pts", ios::binary) << text;
+    Eigen::VectorXd pts;
+    REQUIRE( PointsFile::readPts("test_points.pts", pts) );
+    REQUIRE( pts.rows() == 6 );
+    REQUIRE( pts[4] == 446.875 );
+    REQUIRE( !PointsFile::readPts("test_missing.pts", pts) );
+  }
+
+  SECTION( "Points of a data set" ) {
+    vector<Eigen::VectorXd> points(3);
+    points[0] = Eigen::VectorXd::Random(6);
+    points[2] = Eigen::VectorXd::Random(6);
+    REQUIRE( PointsFile::write("test_points.bin", points) );
+
+    PointsFile::Reader reader;
+    REQUIRE( reader.open("test_points.bin") );
+    REQUIRE( reader.header().nimages == 3 );
+    REQUIRE( reader.header().Lfp == 6 );
+    REQUIRE( Eigen::Map<const Eigen::VectorXd>(reader.points(0), 6) == points[0] );
+    REQUIRE( reader.points(1) == nullptr );
+    REQUIRE( Eigen::Map<const Eigen::VectorXd>(reader.points(2), 6) == points[2] );
+    REQUIRE( reader.points(3) == nullptr );
+  }
+}
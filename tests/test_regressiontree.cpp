@@ -0,0 +1,155 @@
+#include <iostream>
+using namespace std;
+
+#define CATCH_CONFIG_MAIN
+#include "../extras/Catch/single_include/catch.hpp"
+
+#include "../regressiontree.hpp"
+#include "../regressionforest.hpp"
+
+TEST_CASE("Tests for compiled regression tree", "[RegressionTree]") {
+  const int nsamples = 500, npixels = 40, depth = 4;
+
+  std::default_random_engine e(0);
+  std::uniform_int_distribution<int> intensity(0, 255);
+  std::normal_distribution<double> noise(0, 1);
+
+  Eigen::MatrixXd pixels(nsamples, npixels), ds(nsamples, 2);
+  for (int i = 0; i < nsamples; ++i) {
+    for (int j = 0; j < npixels; ++j) pixels(i, j) = intensity(e);
+    ds(i, 0) = (pixels(i, 0) - pixels(i, 1)) * 0.01 + noise(e);
+    ds(i, 1) = (pixels(i, 2) - pixels(i, 3)) * 0.01 + noise(e);
+  }
+
+  auto checkLeafLayout = [&](const RegressionTree<> &tree) {
+    REQUIRE( tree.numLeaves() == (1 << depth) );
+    for (int i = 0; i < nsamples; ++i) {
+      Eigen::VectorXd sample = pixels.row(i);
+      int leaf = tree.leafIndex(sample);
+      REQUIRE( leaf >= 0 );
+      REQUIRE( leaf < tree.numLeaves() );
+
+      vector<bool> lbf = tree.localBinaryFeature(sample);
+      REQUIRE( lbf.size() == tree.numLeaves() );
+      REQUIRE( std::count(lbf.begin(), lbf.end(), true) == 1 );
+      REQUIRE( lbf[leaf] );
+    }
+  };
+
+  auto checkLeafOutputs = [&](const RegressionTree<> &tree) {
+    Eigen::MatrixXd sums = Eigen::MatrixXd::Zero(2, tree.numLeaves());
+    vector<int> counts(tree.numLeaves(), 0);
+    for (int i = 0; i < nsamples; ++i) {
+      int leaf = tree.leafIndex(Eigen::VectorXd(pixels.row(i)));
+      sums.col(leaf) += ds.row(i).transpose();
+      ++counts[leaf];
+    }
+    for (int i = 0; i < nsamples; ++i) {
+      Eigen::VectorXd sample = pixels.row(i);
+      int leaf = tree.leafIndex(sample);
+      Eigen::Vector2d meanval = sums.col(leaf) / counts[leaf];
+      REQUIRE( (tree.predict(sample) - meanval).norm() < 1e-9 );
+    }
+  };
+
+  RegressionTree<> exact(20, depth, 0), histogram(20, depth, 0, RegressionTree<>::VarianceReduction, 1);
+  exact.train(pixels, ds);
+  histogram.train(pixels, ds);
+
+  SECTION( "Leaf layout" ) {
+    checkLeafLayout(exact);
+    checkLeafLayout(histogram);
+  }
+
+  SECTION( "Leaf outputs are the mean of the training samples" ) {
+    checkLeafOutputs(exact);
+    checkLeafOutputs(histogram);
+  }
+
+  SECTION( "8-bit features" ) {
+    PixelMatrix<uint8_t> pixels8 = pixels.cast<uint8_t>();
+    RegressionTree<> exact8(20, depth, 0), histogram8(20, depth, 0, RegressionTree<>::VarianceReduction, 1);
+    exact8.train(pixels8, ds);
+    histogram8.train(pixels8, ds);
+    for (int i = 0; i < nsamples; ++i) {
+      Eigen::VectorXd sample = pixels.row(i);
+      REQUIRE( exact8.leafIndex(sample) == exact.leafIndex(sample) );
+      REQUIRE( histogram8.leafIndex(sample) == histogram.leafIndex(sample) );
+      REQUIRE( exact8.predict(sample) == exact.predict(sample) );
+    }
+  }
+}
+
+TEST_CASE("Tests for split objectives", "[RegressionTree]") {
+  const int nsamples = 200;
+
+  std::default_random_engine e(2);
+  std::uniform_int_distribution<int> intensity(0, 255);
+
+  // the target is a step function of the difference of the two pixels
+  Eigen::MatrixXd pixels(nsamples, 2), ds(nsamples, 2);
+  for (int i = 0; i < nsamples; ++i) {
+    pixels(i, 0) = intensity(e);
+    pixels(i, 1) = intensity(e);
+    double step = pixels(i, 0) - pixels(i, 1) < 10 ? -1.0 : 1.0;
+    ds(i, 0) = step;
+    ds(i, 1) = 2 * step;
+  }
+
+  auto checkStep = [&](RegressionTree<>::SplitObjective objective, int binWidth) {
+    RegressionTree<> tree(2, 1, 0, objective, binWidth);
+    tree.train(pixels, ds);
+    for (int i = 0; i < nsamples; ++i) {
+      Eigen::VectorXd sample = pixels.row(i);
+      REQUIRE( (tree.predict(sample) - Eigen::Vector2d(ds.row(i))).norm() < 1e-9 );
+    }
+  };
+
+  SECTION( "Variance reduction" ) {
+    checkStep(RegressionTree<>::VarianceReduction, 0);
+  }
+
+  SECTION( "L2 norm" ) {
+    checkStep(RegressionTree<>::L2Norm, 0);
+  }
+
+  SECTION( "Histogram" ) {
+    checkStep(RegressionTree<>::VarianceReduction, 1);
+    checkStep(RegressionTree<>::VarianceReduction, 5);
+  }
+}
+
+TEST_CASE("Tests for parallel forest training", "[RegressionForest]") {
+  const int nsamples = 300, npixels = 40;
+
+  std::default_random_engine e(1);
+  std::uniform_int_distribution<int> intensity(0, 255);
+  std::normal_distribution<double> noise(0, 1);
+
+  Eigen::MatrixXd pixels(nsamples, npixels), ds(nsamples, 2);
+  for (int i = 0; i < nsamples; ++i) {
+    for (int j = 0; j < npixels; ++j) pixels(i, j) = intensity(e);
+    ds(i, 0) = noise(e);
+    ds(i, 1) = noise(e);
+  }
+
+  SECTION( "Results do not depend on the number of threads" ) {
+    typedef RegressionForest<RegressionTree<>> forest_t;
+    forest_t serial, parallel;
+    serial.init(16, 3, 20, 0);
+    parallel.init(16, 3, 20, 0);
+
+    omp_set_num_threads(1);
+    serial.train(pixels, ds, 42);
+    omp_set_num_threads(4);
+    parallel.train(pixels, ds, 42);
+
+    for (int i = 0; i < nsamples; ++i) {
+      Eigen::VectorXd sample = pixels.row(i);
+      for (int j = 0; j < serial.ntrees; ++j) {
+        REQUIRE( serial.trees[j].leafIndex(sample) == parallel.trees[j].leafIndex(sample) );
+        REQUIRE( serial.trees[j].predict(sample) == parallel.trees[j].predict(sample) );
+      }
+    }
+  }
+}
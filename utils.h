@@ -22,3 +22,24 @@ string toString(T val) {
 inline Eigen::Vector2d extractPoint(const Eigen::VectorXd &v, int idx) {
   return Eigen::Vector2d(v[idx*2], v[idx*2+1]);
 }
+
+// distance between the pupil centers of a 68 point shape, each pupil is the
+// center of the 4 eyelid points
+inline double interPupilDistance(const Eigen::VectorXd &shape) {
+  Eigen::Vector2d leftPupil = (extractPoint(shape, 37) + extractPoint(shape, 38) + extractPoint(shape, 40) + extractPoint(shape, 41)) * 0.25;
+  Eigen::Vector2d rightPupil = (extractPoint(shape, 43) + extractPoint(shape, 44) + extractPoint(shape, 46) + extractPoint(shape, 47)) * 0.25;
+  return (leftPupil - rightPupil).norm();
+}
+
+// distance between the outer eye corners of a 68 point shape
+inline double interOcularDistance(const Eigen::VectorXd &shape) {
+  return (extractPoint(shape, 36) - extractPoint(shape, 45)).norm();
+}
+
+// mean point to point distance between two shapes
+inline double meanError(const Eigen::VectorXd &shape, const Eigen::VectorXd &truth) {
+  int n = shape.rows() / 2;
+  double err = 0;
+  for (int i = 0; i < n; ++i) err += (extractPoint(shape, i) - extractPoint(truth, i)).norm();
+  return err / n;
+}